@@ -1,10 +1,16 @@
 #include "file.h"
 
-#if defined(_WIN32) && !defined(__CYGWIN__) && !defined(__GNUC__)
+#if defined(_WIN32)
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN 1
 #endif
 #include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 FILE* fopen_utf8(const char* file, const char* mode) {
@@ -73,4 +79,110 @@ int fseeki64(FILE* file, int64_t offset, int origin) {
 #else
     return fseeko(file, offset, origin);
 #endif
-}
\ No newline at end of file
+}
+
+int64_t read_file_at(FILE* file, void* dst, int64_t size, int64_t offset) {
+    ASSERT(file);
+    int64_t bytes_read = 0;
+#if defined(_WIN32)
+    HANDLE handle = (HANDLE)_get_osfhandle(_fileno(file));
+    while (bytes_read < size) {
+        const int64_t pos = offset + bytes_read;
+        OVERLAPPED ov = {};
+        ov.Offset = (DWORD)(pos & 0xFFFFFFFF);
+        ov.OffsetHigh = (DWORD)(pos >> 32);
+        const DWORD chunk = (DWORD)(size - bytes_read < 0x40000000 ? size - bytes_read : 0x40000000);
+        DWORD n = 0;
+        if (!ReadFile(handle, (char*)dst + bytes_read, chunk, &n, &ov) || n == 0) break;
+        bytes_read += n;
+    }
+#else
+    const int fd = fileno(file);
+    while (bytes_read < size) {
+        const ssize_t n = pread(fd, (char*)dst + bytes_read, (size_t)(size - bytes_read), (off_t)(offset + bytes_read));
+        if (n <= 0) break;
+        bytes_read += n;
+    }
+#endif
+    return bytes_read;
+}
+
+bool map_file(MappedFile* mapped, CStringView filename, MapAccess access, bool copy_on_write) {
+    ASSERT(mapped);
+    *mapped = {};
+    if (filename.length() == 0) return false;
+
+#if defined(_WIN32)
+    wchar_t w_file[MAX_PATH];
+    const int w_file_len = MultiByteToWideChar(CP_UTF8, 0, filename.cstr(), (int)filename.length(), w_file, MAX_PATH);
+    if (w_file_len >= MAX_PATH) return false;
+    w_file[w_file_len] = L'\0';
+
+    const DWORD flags = access == MapAccess::Sequential ? FILE_FLAG_SEQUENTIAL_SCAN : (access == MapAccess::Random ? FILE_FLAG_RANDOM_ACCESS : FILE_ATTRIBUTE_NORMAL);
+    HANDLE file = CreateFileW(w_file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart <= 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingW(file, NULL, copy_on_write ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) {
+        CloseHandle(file);
+        return false;
+    }
+
+    void* ptr = MapViewOfFile(mapping, copy_on_write ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+    if (!ptr) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    mapped->data = (const char*)ptr;
+    mapped->size = (i64)size.QuadPart;
+    mapped->handle[0] = file;
+    mapped->handle[1] = mapping;
+#else
+    StringBuffer<512> z_file = filename;
+    const int fd = open(z_file.cstr(), O_RDONLY);
+    if (fd == -1) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+
+    void* ptr = mmap(NULL, (size_t)st.st_size, copy_on_write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+    // @NOTE: The mapping keeps its own reference to the file, so the descriptor is not needed anymore
+    close(fd);
+    if (ptr == MAP_FAILED) return false;
+
+    if (access == MapAccess::Sequential) {
+        madvise(ptr, (size_t)st.st_size, MADV_SEQUENTIAL);
+    } else if (access == MapAccess::Random) {
+        madvise(ptr, (size_t)st.st_size, MADV_RANDOM);
+    }
+
+    mapped->data = (const char*)ptr;
+    mapped->size = (i64)st.st_size;
+#endif
+    return true;
+}
+
+void unmap_file(MappedFile* mapped) {
+    ASSERT(mapped);
+    if (!mapped->data) return;
+
+#if defined(_WIN32)
+    UnmapViewOfFile(mapped->data);
+    if (mapped->handle[1]) CloseHandle((HANDLE)mapped->handle[1]);
+    if (mapped->handle[0]) CloseHandle((HANDLE)mapped->handle[0]);
+#else
+    munmap((void*)mapped->data, (size_t)mapped->size);
+#endif
+    *mapped = {};
+}
@@ -9,4 +9,27 @@ FILE* fopen_utf8(const char* filename, const char* mode);
 FILE* fopen(CStringView filename, CStringView mode);
 
 int64_t ftelli64(FILE* file);
-int fseeki64(FILE* file, int64_t offset, int origin);
\ No newline at end of file
+int fseeki64(FILE* file, int64_t offset, int origin);
+
+// Reads size bytes located at offset within the file without seeking (pread), so it can be used concurrently on the same file from several threads.
+// Returns the number of bytes read.
+// @NOTE: Do not mix with buffered reads (fread) on the same FILE.
+int64_t read_file_at(FILE* file, void* dst, int64_t size, int64_t offset);
+
+// Read-only memory mapping of an entire file.
+// The contents are NOT zero-terminated, use the size to bound any parsing.
+struct MappedFile {
+    const char* data = nullptr;
+    i64 size = 0;
+    void* handle[2] = {};  // Platform specific handles (file, mapping)
+
+    operator CStringView() const { return {data, size}; }
+    operator bool() const { return data != nullptr; }
+};
+
+enum class MapAccess { Default, Sequential, Random };
+
+// Maps the file into memory. The access hint is forwarded to the OS (madvise on posix) to tune read-ahead.
+// If copy_on_write is set, the pages are writable but modifications stay private to the process and never reach the file.
+bool map_file(MappedFile* mapped, CStringView filename, MapAccess access = MapAccess::Sequential, bool copy_on_write = false);
+void unmap_file(MappedFile* mapped);
@@ -10,6 +10,25 @@ inline uint32_t clz(uint32_t v) {
 inline uint64_t clz(uint64_t v) {
     return __builtin_clzll(v);
 }
+
+// count bits
+inline uint32_t popcnt(uint32_t v) {
+    return __builtin_popcount(v);
+}
+
+// count bits 64-bit
+inline uint64_t popcnt(uint64_t v) {
+    return __builtin_popcountll(v);
+}
+
+// @NOTE: Undefined for 0, same as the builtins
+inline uint32_t ctz(uint32_t v) {
+    return __builtin_ctz(v);
+}
+
+inline uint64_t ctz(uint64_t v) {
+    return __builtin_ctzll(v);
+}
 #endif
 
 #if COMPILER_MSVC
@@ -0,0 +1,196 @@
+#include "neighbor_list.h"
+#include <core/common.h>
+#include <core/log.h>
+#include <core/sync.h>
+
+// Cells are handed out to the threads in blocks, the number of points per cell varies too much for an even split
+constexpr i32 CELL_BLOCK_SIZE = 64;
+
+// Gathers the cells within the 3x3x3 neighborhood of a cell which have a higher index than the cell itself, each cell only once.
+// In periodic frames with fewer than three cells along an axis, several offsets wrap to the same cell.
+static i32 get_upper_neighbor_cells(i32 out[26], const spatialhash::Frame& frame, ivec3 cell_coord, bool periodic) {
+    const i32 home = spatialhash::compute_cell_idx(frame, cell_coord);
+    i32 count = 0;
+    for (i32 z = -1; z <= 1; z++) {
+        for (i32 y = -1; y <= 1; y++) {
+            for (i32 x = -1; x <= 1; x++) {
+                ivec3 cc = cell_coord + ivec3(x, y, z);
+                if (periodic) {
+                    cc = spatialhash::wrap_cell_coord(frame, cc);
+                } else if (cc.x < 0 || cc.y < 0 || cc.z < 0 || cc.x >= frame.cell_count.x || cc.y >= frame.cell_count.y || cc.z >= frame.cell_count.z) {
+                    continue;
+                }
+                const i32 idx = spatialhash::compute_cell_idx(frame, cc);
+                if (idx <= home) continue;
+
+                bool found = false;
+                for (i32 i = 0; i < count; i++) {
+                    if (out[i] == idx) {
+                        found = true;
+                        break;
+                    }
+                }
+                if (!found) out[count++] = idx;
+            }
+        }
+    }
+    return count;
+}
+
+// Visits the neighbors of each point of a cell, func(a, b, d2) where a is a point of the cell and b is either a later point of the same cell or a point of an upper neighbor cell.
+// The neighbors of each point are visited consecutively.
+template <typename Func>
+static void for_each_cell_pair(const spatialhash::Frame& frame, i32 cell_idx, float r2, bool periodic, Func func) {
+    const ivec3 cell_coord = {cell_idx % frame.cell_count.x, (cell_idx / frame.cell_count.x) % frame.cell_count.y,
+                              cell_idx / (frame.cell_count.x * frame.cell_count.y)};
+    const spatialhash::Cell home = frame.cells[cell_idx];
+    if (home.count == 0) return;
+
+    i32 neighbor_cells[26];
+    const i32 num_neighbor_cells = get_upper_neighbor_cells(neighbor_cells, frame, cell_coord, periodic);
+
+    const i32 home_end = home.offset + home.count;
+    for (i32 i = home.offset; i < home_end; i++) {
+        const vec3 pos = spatialhash::get_entry_position(frame, i);
+        const i32 a = frame.entry_index[i];
+        const auto pair = [&](i32 entry) {
+            vec3 d = spatialhash::get_entry_position(frame, entry) - pos;
+            if (periodic) d -= frame.period * math::round(d / frame.period);
+            func(a, frame.entry_index[entry], math::dot(d, d));
+        };
+        spatialhash::for_each_entry_within(frame, i + 1, home_end, pos, r2, pair);
+        for (i32 k = 0; k < num_neighbor_cells; k++) {
+            const spatialhash::Cell cell = frame.cells[neighbor_cells[k]];
+            spatialhash::for_each_entry_within(frame, cell.offset, cell.offset + cell.count, pos, r2, pair);
+        }
+    }
+}
+
+// Executes func(cell_idx) for all cells of the frame, distributed over num_threads threads in blocks of cells
+template <typename Func>
+static void for_each_cell_parallel(const spatialhash::Frame& frame, i32 num_threads, Func func) {
+    const i32 num_cells = (i32)frame.cells.size();
+    atomic_int32_t next_block = 0;
+    run_on_threads(num_threads, [&](i32 thread_idx) {
+        (void)thread_idx;
+        i32 beg;
+        while ((beg = atomic_fetch_add(&next_block, CELL_BLOCK_SIZE)) < num_cells) {
+            const i32 end = beg + CELL_BLOCK_SIZE < num_cells ? beg + CELL_BLOCK_SIZE : num_cells;
+            for (i32 c = beg; c < end; c++) {
+                func(c);
+            }
+        }
+    });
+}
+
+bool compute_neighbor_list(NeighborList* list, const float* pos_x, const float* pos_y, const float* pos_z, i64 count, const NeighborListOptions& opt) {
+    ASSERT(list);
+    if (opt.cutoff <= 0 || opt.skin < 0) {
+        LOG_ERROR("Invalid cutoff or skin for neighbor list");
+        return false;
+    }
+    if (opt.selection && opt.selection.size() != count) {
+        LOG_ERROR("Neighbor list selection does not match the number of points");
+        return false;
+    }
+
+    const float radius = opt.cutoff + opt.skin;
+    const vec3 box_ext = {opt.box[0][0], opt.box[1][1], opt.box[2][2]};
+    const bool periodic = box_ext.x > 0 && box_ext.y > 0 && box_ext.z > 0;
+    if (periodic && radius > 0.5f * math::min(box_ext.x, math::min(box_ext.y, box_ext.z))) {
+        LOG_ERROR("Neighbor list cutoff and skin exceed half of the periodic box");
+        return false;
+    }
+
+    list->cutoff = opt.cutoff;
+    list->skin = opt.skin;
+    list->period = periodic ? box_ext : vec3(0);
+
+    const i64 num_points = opt.selection ? bitfield::number_of_bits_set(opt.selection) : count;
+    list->point_index.resize(num_points);
+    list->point_position.resize(num_points * 3);
+    float* px = list->point_position.data();
+    float* py = px + num_points;
+    float* pz = py + num_points;
+    i64 n = 0;
+    for (i64 i = 0; i < count; i++) {
+        if (opt.selection && !bitfield::get_bit(opt.selection, i)) continue;
+        list->point_index[n] = (i32)i;
+        px[n] = pos_x[i];
+        py[n] = pos_y[i];
+        pz[n] = pos_z[i];
+        n++;
+    }
+
+    const i32 num_threads = get_num_threads(opt.num_threads);
+    if (periodic) {
+        spatialhash::compute_frame_periodic(&list->frame, px, py, pz, num_points, vec3(radius), opt.box, num_threads);
+    } else {
+        spatialhash::compute_frame(&list->frame, px, py, pz, num_points, vec3(radius), num_threads);
+    }
+
+    list->offsets.resize(count + 1);
+    memset(list->offsets.data(), 0, list->offsets.size_in_bytes());
+    if (num_points == 0) {
+        list->indices.clear();
+        list->distances.clear();
+        return true;
+    }
+
+    const spatialhash::Frame& frame = list->frame;
+    const i32* point_index = list->point_index.data();
+    i64* offsets = list->offsets.data();
+    const float r2 = radius * radius;
+
+    // @NOTE: The pairs are counted in a first pass and written in a second, so that every row can be written in place by the thread which owns its point.
+    // Each point belongs to exactly one cell, so the rows of different cells never overlap.
+    for_each_cell_parallel(frame, num_threads, [&](i32 cell_idx) {
+        for_each_cell_pair(frame, cell_idx, r2, periodic, [&](i32 a, i32 b, float d2) {
+            (void)b;
+            (void)d2;
+            offsets[point_index[a] + 1]++;
+        });
+    });
+
+    for (i64 i = 0; i < count; i++) {
+        offsets[i + 1] += offsets[i];
+    }
+
+    const i64 num_pairs = offsets[count];
+    list->indices.resize(num_pairs);
+    list->distances.resize(opt.store_distances ? num_pairs : 0);
+    i32* indices = list->indices.data();
+    float* distances = opt.store_distances ? list->distances.data() : nullptr;
+
+    for_each_cell_parallel(frame, num_threads, [&](i32 cell_idx) {
+        i32 row = -1;
+        i64 cursor = 0;
+        for_each_cell_pair(frame, cell_idx, r2, periodic, [&](i32 a, i32 b, float d2) {
+            if (point_index[a] != row) {
+                row = point_index[a];
+                cursor = offsets[row];
+            }
+            if (distances) distances[cursor] = math::sqrt(d2);
+            indices[cursor++] = point_index[b];
+        });
+    });
+
+    return true;
+}
+
+bool neighbor_list_needs_rebuild(const NeighborList& list, const soa_vec3& positions) {
+    const i64 num_points = list.point_index.size();
+    const float* px = list.point_position.data();
+    const float* py = px + num_points;
+    const float* pz = py + num_points;
+    const float max_d2 = (0.5f * list.skin) * (0.5f * list.skin);
+    const bool periodic = list.period.x > 0;
+
+    for (i64 i = 0; i < num_points; i++) {
+        const i32 idx = list.point_index[i];
+        vec3 d = vec3(positions.x[idx], positions.y[idx], positions.z[idx]) - vec3(px[i], py[i], pz[i]);
+        if (periodic) d -= list.period * math::round(d / list.period);
+        if (math::dot(d, d) > max_d2) return true;
+    }
+    return false;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <core/types.h>
+#include <core/array_types.h>
+#include <core/bitfield.h>
+#include <core/math_utils.h>
+#include <core/spatial_hash.h>
+
+// Verlet neighbor list, all pairs of points within cutoff + skin in compressed sparse row (CSR) form.
+// Each pair is stored once (half list), in the row of one of its two points: the neighbors of point i are indices[offsets[i] .. offsets[i + 1]).
+// Rows and neighbor indices refer to the points of the input, also if the list is built for a selection (unselected points have empty rows).
+// With a skin the list can be reused over several frames until any point has moved more than half of the skin (see neighbor_list_needs_rebuild),
+// pairs then have to be tested against the cutoff with the current positions (see for_each_neighbor_pair).
+
+struct NeighborListOptions {
+    float cutoff = 0;
+    float skin = 0;
+    mat3 box = {0, 0, 0, 0, 0, 0, 0, 0, 0};  // Periodic box (minimum image), zero if the points are not periodic
+    Bitfield selection{};                    // Optional, only pairs between selected points are listed
+    bool store_distances = false;            // Store the distance of each pair at the time of the build
+    i32 num_threads = 0;                     // <= 0 uses all hardware threads
+};
+
+struct NeighborList {
+    float cutoff = 0;
+    float skin = 0;
+    vec3 period{};  // Extent of the periodic box, zero if not periodic
+
+    DynamicArray<i64> offsets{};      // Number of points + 1, 64-bit since the number of pairs can exceed 2^31
+    DynamicArray<i32> indices{};      // Neighbor of each pair
+    DynamicArray<float> distances{};  // Optional, distance of each pair
+
+    // Selected points and their positions at the time of the build, used to decide if the list has to be rebuilt
+    DynamicArray<i32> point_index{};
+    DynamicArray<float> point_position{};  // [x, y, z][selected point]
+
+    // Spatial hash of the selected points, kept so that rebuilding the list reuses its memory
+    spatialhash::Frame frame{};
+};
+
+// Builds (or rebuilds) the list for the points, in parallel over the cells of a spatial hash with a cell extent of cutoff + skin.
+// Every pair of neighboring cells is only visited once, from the cell with the lower index (half shell), so no pair is tested twice.
+// The result does not depend on the number of threads.
+bool compute_neighbor_list(NeighborList* list, const float* pos_x, const float* pos_y, const float* pos_z, i64 count, const NeighborListOptions& opt);
+inline bool compute_neighbor_list(NeighborList* list, const soa_vec3& positions, i64 count, const NeighborListOptions& opt) {
+    return compute_neighbor_list(list, positions.x, positions.y, positions.z, count, opt);
+}
+
+// True if any point of the list has moved more than half of the skin since the list was built, in which case pairs within the cutoff may be missing
+bool neighbor_list_needs_rebuild(const NeighborList& list, const soa_vec3& positions);
+
+inline i64 get_neighbor_pair_count(const NeighborList& list) { return list.indices.size(); }
+
+inline Array<const i32> get_neighbors(const NeighborList& list, i32 point_idx) {
+    return {list.indices.data() + list.offsets[point_idx], list.offsets[point_idx + 1] - list.offsets[point_idx]};
+}
+
+// Invokes cb(i, j, d2) for every pair of the list which is within the cutoff for the current positions
+template <typename Callback>
+void for_each_neighbor_pair(const NeighborList& list, const soa_vec3& positions, Callback cb) {
+    const float r2 = list.cutoff * list.cutoff;
+    const bool periodic = list.period.x > 0;
+    const i32 num_points = (i32)list.offsets.size() - 1;
+    for (i32 i = 0; i < num_points; i++) {
+        const vec3 pi = {positions.x[i], positions.y[i], positions.z[i]};
+        for (i64 k = list.offsets[i]; k < list.offsets[i + 1]; k++) {
+            const i32 j = list.indices[k];
+            vec3 d = vec3(positions.x[j], positions.y[j], positions.z[j]) - pi;
+            if (periodic) d -= list.period * math::round(d / list.period);
+            const float d2 = math::dot(d, d);
+            if (d2 < r2) cb(i, j, d2);
+        }
+    }
+}
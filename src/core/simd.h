@@ -1,5 +1,7 @@
 #pragma once
 
+#include "types.h"
+
 #if defined(_MSC_VER)
 /* Microsoft C/C++-compatible compiler */
 #include <intrin.h>
@@ -20,6 +22,7 @@
 #define SIMD_LOAD_F simd::load_f256
 #define SIMD_SET_F simd::set_f256
 #define SIMD_ZERO_F simd::zero_f256()
+#define SIMD_LOAD_U16_F simd::load_u16_f256
 #define SIMD_TYPE_I __m256i
 #define SUMD_LOAD_I simd::load_i256
 #define SIMD_SET_I simd::set_i256
@@ -30,6 +33,7 @@
 #define SIMD_LOAD_F simd::load_f128
 #define SIMD_SET_F simd::set_f128
 #define SIMD_ZERO_F simd::zero_f128()
+#define SIMD_LOAD_U16_F simd::load_u16_f128
 #define SIMD_TYPE_I __m128i
 #define SUMD_LOAD_I simd::load_i128
 #define SIMD_SET_I simd::set_i128
@@ -88,6 +92,10 @@ INLINE float128 load_aligned_f128(const float* addr) {
     return _mm_load_ps(addr);
 }
 
+// Loads 4 unsigned 16-bit integers and converts them to float
+// @NOTE: Widens by interleaving with zero, since _mm_cvtepu16_epi32 requires SSE4.1
+INLINE float128 load_u16_f128(const u16* addr) { return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)addr), _mm_setzero_si128())); }
+
 INLINE void store(float* addr, float128 v) { _mm_storeu_ps(addr, v); }
 INLINE void store_aligned(float* addr, float128 v) {
     ASSERT(IS_ALIGNED(addr, 16));
@@ -121,9 +129,16 @@ INLINE float128 cmp_le(float128 a, float128 b) { return _mm_cmple_ps(a, b); }
 INLINE float128 cmp_eq(float128 a, float128 b) { return _mm_cmpeq_ps(a, b); }
 INLINE float128 cmp_neq(float128 a, float128 b) { return _mm_cmpneq_ps(a, b); }
 
+// Bit i of the result holds the sign bit of lane i, e.g. the result of a comparison
+INLINE int move_mask(float128 a) { return _mm_movemask_ps(a); }
+
 INLINE float128 abs(float128 a) { return _mm_and_ps(a, _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF))); }
 INLINE int128 abs(int128 a) { return _mm_abs_epi32(a); }
 
+// Rounds to the nearest integer (ties to even under the default rounding mode), only valid for |a| < 2^31
+// @NOTE: Converts through int32 since _mm_round_ps requires SSE4.1
+INLINE float128 round(float128 a) { return _mm_cvtepi32_ps(_mm_cvtps_epi32(a)); }
+
 // @NOTE: If 0.0f is given as input, it will be mapped to 1.0f
 INLINE float128 sign(float128 x) {
 	const float128 sgn = bit_and(x, set_f128(-0.0f));
@@ -200,6 +215,23 @@ INLINE float128 cubic_spline(__m128 p0, __m128 p1, __m128 p2, __m128 p3, float s
     return res;
 }
 
+// Deinterleaves four packed xyz triplets [x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3] into separate x, y and z registers
+INLINE void deinterleave_xyz(float128& x, float128& y, float128& z, const float* in_xyz) {
+    const float128 a = _mm_loadu_ps(in_xyz + 0);
+    const float128 b = _mm_loadu_ps(in_xyz + 4);
+    const float128 c = _mm_loadu_ps(in_xyz + 8);
+
+    const float128 x23 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(0, 1, 0, 2));
+    const float128 y01 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 0, 1));
+    const float128 y23 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3));
+    const float128 z01 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2));
+    const float128 z23 = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0));
+
+    x = _mm_shuffle_ps(a, x23, _MM_SHUFFLE(2, 0, 3, 0));
+    y = _mm_shuffle_ps(y01, y23, _MM_SHUFFLE(2, 0, 2, 0));
+    z = _mm_shuffle_ps(z01, z23, _MM_SHUFFLE(2, 0, 2, 0));
+}
+
 // 256-bit wide
 #ifdef __AVX__
 
@@ -222,6 +254,18 @@ INLINE float256 load_aligned_f256(const float* addr) {
 	return _mm256_load_ps(addr);
 }
 
+// Loads 8 unsigned 16-bit integers and converts them to float
+INLINE float256 load_u16_f256(const u16* addr) {
+#ifdef __AVX2__
+    return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)addr)));
+#else
+    const int128 v = _mm_loadu_si128((const __m128i*)addr);
+    const int128 lo = _mm_cvtepu16_epi32(v);
+    const int128 hi = _mm_cvtepu16_epi32(_mm_srli_si128(v, 8));
+    return _mm256_cvtepi32_ps(_mm256_insertf128_si256(_mm256_castsi128_si256(lo), hi, 1));
+#endif
+}
+
 INLINE void store(float* addr, float256 v) { _mm256_storeu_ps(addr, v); }
 INLINE void store_aligned(float* addr, float256 v) {
 	ASSERT(IS_ALIGNED(addr, 16));
@@ -245,8 +289,12 @@ INLINE float256 cmp_le(float256 a, float256 b) { return _mm256_cmp_ps(a, b, _CMP
 INLINE float256 cmp_eq(float256 a, float256 b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
 INLINE float256 cmp_neq(float256 a, float256 b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_OQ); }
 
+INLINE int move_mask(float256 a) { return _mm256_movemask_ps(a); }
+
 INLINE float256 abs(float256 a) { return bit_and(a, _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF))); }
 
+INLINE float256 round(float256 a) { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+
 // @NOTE: If 0.0f is given as input, it will be mapped to 1.0f
 INLINE float256 sign(float256 x) {
 	const float256 sgn = bit_and(x, set_f256(-0.0f));
@@ -1,77 +1,192 @@
 #include "spatial_hash.h"
 #include <core/common.h>
 #include <core/math_utils.h>
+#include <core/sync.h>
 
 #include <atomic>
 
 namespace spatialhash {
 
-void compute_frame(Frame* frame, const float* pos_x, const float* pos_y, const float* pos_z, i64 count, const vec3& cell_ext) {
+// Frames with fewer entries per thread are built on fewer threads, which keeps small frames (e.g. per residue) on the calling thread
+constexpr i64 MIN_ENTRIES_PER_THREAD = 1 << 15;
+
+static i32 get_build_threads(i64 count, i32 num_threads) {
+    num_threads = get_num_threads(num_threads);
+    const i64 max_threads = count / MIN_ENTRIES_PER_THREAD;
+    if (num_threads > max_threads) num_threads = max_threads > 1 ? (i32)max_threads : 1;
+    return num_threads;
+}
+
+// Even split of [0, count) into num_parts contiguous ranges
+static Range<i64> get_part_range(i64 count, i32 num_parts, i32 part) { return {count * part / num_parts, count * (part + 1) / num_parts}; }
+
+void compute_frame(Frame* frame, const float* pos_x, const float* pos_y, const float* pos_z, i64 count, const vec3& cell_ext, i32 num_threads) {
     ASSERT(frame);
     if (count == 0) {
-        *frame = {};
+        frame->min_box = {};
+        frame->max_box = {};
+        frame->cell_ext = {};
+        frame->cell_count = {};
+        frame->period = {};
+        frame->cells.clear();
+        frame->num_entries = 0;
+        frame->entry_x.clear();
+        frame->entry_y.clear();
+        frame->entry_z.clear();
+        frame->entry_index.clear();
         return;
-    };
+    }
+
+    num_threads = get_build_threads(count, num_threads);
+    vec3* thread_box = (vec3*)TMP_MALLOC(num_threads * 2 * sizeof(vec3));
+    defer { TMP_FREE(thread_box); };
+
+    run_on_threads(num_threads, [&](i32 thread_idx) {
+        const Range<i64> range = get_part_range(count, num_threads, thread_idx);
+        vec3 min_box(FLT_MAX);
+        vec3 max_box(-FLT_MAX);
+        for (i64 i = range.beg; i < range.end; i++) {
+            const vec3 p = {pos_x[i], pos_y[i], pos_z[i]};
+            min_box = math::min(min_box, p);
+            max_box = math::max(max_box, p);
+        }
+        thread_box[thread_idx * 2 + 0] = min_box;
+        thread_box[thread_idx * 2 + 1] = max_box;
+    });
 
     vec3 min_box(FLT_MAX);
     vec3 max_box(-FLT_MAX);
-    for (i64 i = 0; i < count; i++) {
-        const vec3 p = {pos_x[i], pos_y[i], pos_z[i]};
-        min_box = math::min(min_box, p);
-        max_box = math::max(max_box, p);
+    for (i32 i = 0; i < num_threads; i++) {
+        min_box = math::min(min_box, thread_box[i * 2 + 0]);
+        max_box = math::max(max_box, thread_box[i * 2 + 1]);
     }
     min_box -= 1.f;
     max_box += 1.f;
-    compute_frame(frame, pos_x, pos_y, pos_z, count, cell_ext, min_box, max_box);
+    compute_frame(frame, pos_x, pos_y, pos_z, count, cell_ext, min_box, max_box, num_threads);
 }
 
-Frame compute_frame(const float* pos_x, const float* pos_y, const float* pos_z, i64 count, const vec3& cell_ext) {
+Frame compute_frame(const float* pos_x, const float* pos_y, const float* pos_z, i64 count, const vec3& cell_ext, i32 num_threads) {
     Frame frame;
-    compute_frame(&frame, pos_x, pos_y, pos_z, count, cell_ext);
+    compute_frame(&frame, pos_x, pos_y, pos_z, count, cell_ext, num_threads);
     return frame;
 }
 
-Frame compute_frame(const float* pos_x, const float* pos_y, const float* pos_z, i64 count, const vec3& cell_ext, const vec3& min_box, const vec3& max_box) {
+Frame compute_frame(const float* pos_x, const float* pos_y, const float* pos_z, i64 count, const vec3& cell_ext, const vec3& min_box, const vec3& max_box,
+                    i32 num_threads) {
     Frame frame;
-    compute_frame(&frame, pos_x, pos_y, pos_z, count, cell_ext, min_box, max_box);
+    compute_frame(&frame, pos_x, pos_y, pos_z, count, cell_ext, min_box, max_box, num_threads);
     return frame;
 }
 
-void compute_frame(Frame* frame, const float* pos_x, const float* pos_y, const float* pos_z, i64 count, const vec3& cell_ext, const vec3& min_box, const vec3& max_box) {
+// Sorts the entries into the cells, the grid of the frame has to be set up
+static void build_cells(Frame* frame, const float* pos_x, const float* pos_y, const float* pos_z, i64 count, i32 num_threads) {
+    const i64 num_cells = (i64)frame->cell_count.x * frame->cell_count.y * frame->cell_count.z;
+    num_threads = get_build_threads(count, num_threads);
+    frame->cells.resize(num_cells);
+    frame->num_entries = (i32)count;
+    frame->entry_x.resize(count + SIMD_WIDTH);
+    frame->entry_y.resize(count + SIMD_WIDTH);
+    frame->entry_z.resize(count + SIMD_WIDTH);
+    frame->entry_index.resize(count + SIMD_WIDTH);
+    frame->entry_cell.resize(count);
+    frame->thread_cell.resize(num_threads * num_cells);
+
+    Cell* cells = frame->cells.data();
+    float* entry_x = frame->entry_x.data();
+    float* entry_y = frame->entry_y.data();
+    float* entry_z = frame->entry_z.data();
+    int* entry_index = frame->entry_index.data();
+    u32* entry_cell = frame->entry_cell.data();
+    u32* thread_cell = frame->thread_cell.data();  // [thread][cell]
+
+    const bool periodic = is_periodic(*frame);
+    u32* part_sum = (u32*)TMP_MALLOC(num_threads * sizeof(u32));
+    defer { TMP_FREE(part_sum); };
+
+    // Histogram of the entries of each thread
+    run_on_threads(num_threads, [&](i32 thread_idx) {
+        u32* cell_count = thread_cell + thread_idx * num_cells;
+        memset(cell_count, 0, num_cells * sizeof(u32));
+        const Range<i64> range = get_part_range(count, num_threads, thread_idx);
+        for (i64 i = range.beg; i < range.end; i++) {
+            const vec3 p = {pos_x[i], pos_y[i], pos_z[i]};
+            const u32 cell_idx = (u32)(periodic ? compute_cell_idx(*frame, compute_periodic_cell_coord(*frame, p)) : compute_cell_idx(*frame, p));
+            entry_cell[i] = cell_idx;
+            cell_count[cell_idx]++;
+        }
+    });
+
+    // Prefix sum over cells (and threads within each cell), each thread sums a range of cells, then offsets it by the sum of the preceding ranges
+    run_on_threads(num_threads, [&](i32 thread_idx) {
+        const Range<i64> range = get_part_range(num_cells, num_threads, thread_idx);
+        u32 sum = 0;
+        for (i64 c = range.beg; c < range.end; c++) {
+            for (i32 t = 0; t < num_threads; t++) sum += thread_cell[t * num_cells + c];
+        }
+        part_sum[thread_idx] = sum;
+    });
+
+    u32 offset = 0;
+    for (i32 i = 0; i < num_threads; i++) {
+        const u32 sum = part_sum[i];
+        part_sum[i] = offset;
+        offset += sum;
+    }
+
+    run_on_threads(num_threads, [&](i32 thread_idx) {
+        const Range<i64> range = get_part_range(num_cells, num_threads, thread_idx);
+        u32 cursor = part_sum[thread_idx];
+        for (i64 c = range.beg; c < range.end; c++) {
+            cells[c].offset = (int)cursor;
+            for (i32 t = 0; t < num_threads; t++) {
+                // The count of each thread turns into the position where the thread starts writing its entries of the cell
+                const u32 thread_count = thread_cell[t * num_cells + c];
+                thread_cell[t * num_cells + c] = cursor;
+                cursor += thread_count;
+            }
+            cells[c].count = (int)(cursor - (u32)cells[c].offset);
+        }
+    });
+
+    // Scatter, threads write disjoint slots and entries within a cell keep their input order
+    run_on_threads(num_threads, [&](i32 thread_idx) {
+        u32* cell_cursor = thread_cell + thread_idx * num_cells;
+        const Range<i64> range = get_part_range(count, num_threads, thread_idx);
+        for (i64 i = range.beg; i < range.end; i++) {
+            const u32 dst = cell_cursor[entry_cell[i]]++;
+            entry_x[dst] = pos_x[i];
+            entry_y[dst] = pos_y[i];
+            entry_z[dst] = pos_z[i];
+            entry_index[dst] = (int)i;
+        }
+    });
+}
+
+void compute_frame(Frame* frame, const float* pos_x, const float* pos_y, const float* pos_z, i64 count, const vec3& cell_ext, const vec3& min_box,
+                   const vec3& max_box, i32 num_threads) {
     ASSERT(frame);
     if (count == 0) return;
 
     frame->min_box = min_box;
     frame->max_box = max_box;
+    frame->period = {};
     frame->cell_count = math::max(ivec3(1), ivec3((max_box - min_box) / cell_ext));
     frame->cell_ext = (max_box - min_box) / (vec3)frame->cell_count;
-    frame->cells.resize(frame->cell_count.x * frame->cell_count.y * frame->cell_count.z);
-    frame->entries.resize(count);
-    memset(frame->cells.data(), 0, frame->cells.size() * sizeof(Cell));
-
-    u32* l_idx = (u32*)TMP_MALLOC(count * sizeof(u32));
-    u32* g_idx = (u32*)TMP_MALLOC(count * sizeof(u32));
-    defer {
-        TMP_FREE(l_idx);
-        TMP_FREE(g_idx);
-    };
-
-    for (int i = 0; i < count; i++) {
-        const vec3 p = {pos_x[i], pos_y[i], pos_z[i]};
-        int cell_idx = compute_cell_idx(*frame, p);
-        l_idx[i] = frame->cells[cell_idx].count++;
-        g_idx[i] = cell_idx;
-    }
+    build_cells(frame, pos_x, pos_y, pos_z, count, num_threads);
+}
 
-    for (int i = 1; i < frame->cells.size(); i++) {
-        frame->cells[i].offset = frame->cells[i - 1].offset + frame->cells[i - 1].count;
-    }
+void compute_frame_periodic(Frame* frame, const float* pos_x, const float* pos_y, const float* pos_z, i64 count, const vec3& cell_ext, const mat3& box,
+                            i32 num_threads) {
+    ASSERT(frame);
+    const vec3 box_ext = {box[0][0], box[1][1], box[2][2]};
+    ASSERT(box_ext.x > 0 && box_ext.y > 0 && box_ext.z > 0);
 
-    for (int i = 0; i < frame->entries.size(); i++) {
-        int dst = frame->cells[g_idx[i]].offset + l_idx[i];
-        frame->entries[dst].position = {pos_x[i], pos_y[i], pos_z[i]};
-        frame->entries[dst].index = i;
-    }
+    frame->min_box = vec3(0);
+    frame->max_box = box_ext;
+    frame->period = box_ext;
+    frame->cell_count = math::max(ivec3(1), ivec3(box_ext / cell_ext));
+    frame->cell_ext = box_ext / (vec3)frame->cell_count;
+    build_cells(frame, pos_x, pos_y, pos_z, count, num_threads);
 }
 
 }  // namespace spatialhash
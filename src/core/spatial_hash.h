@@ -3,14 +3,11 @@
 #include <core/types.h>
 #include <core/array_types.h>
 #include <core/math_utils.h>
+#include <core/simd.h>
+#include <core/intrinsics.h>
 
 namespace spatialhash {
 
-struct Entry {
-    vec3 position{};
-    int index = 0;
-};
-
 struct Cell {
     int offset = 0;
     int count = 0;
@@ -21,9 +18,21 @@ struct Frame {
     vec3 max_box{};
     vec3 cell_ext{};
     ivec3 cell_count{};
+    vec3 period{};  // Extent of the periodic box, zero if the frame is not periodic (see compute_frame_periodic)
 
     DynamicArray<Cell> cells{};
-    DynamicArray<Entry> entries{};
+
+    // Entries sorted by cell, stored as planes (x, y, z and the index of each entry within the input) so that they can be tested SIMD_WIDTH at a time.
+    // The planes hold SIMD_WIDTH padding entries past num_entries, so the entries of any cell can be loaded in full vectors.
+    i32 num_entries = 0;
+    DynamicArray<float> entry_x{};
+    DynamicArray<float> entry_y{};
+    DynamicArray<float> entry_z{};
+    DynamicArray<int> entry_index{};
+
+    // Scratch memory of compute_frame, kept within the frame so that rebuilding it reuses the allocations
+    DynamicArray<u32> entry_cell{};   // Cell of each entry in input order
+    DynamicArray<u32> thread_cell{};  // Per thread entry count (cursor) of each cell
 };
 
 inline int compute_cell_idx(const Frame& frame, ivec3 cell_coord) {
@@ -40,39 +49,106 @@ inline ivec3 compute_cell_coord(const Frame& frame, vec3 coord) {
 
 inline int compute_cell_idx(const Frame& frame, vec3 coord) { return compute_cell_idx(frame, compute_cell_coord(frame, coord)); }
 
+inline bool is_periodic(const Frame& frame) { return frame.period.x > 0; }
+
+// Wraps a cell coordinate of a periodic frame into the grid
+inline ivec3 wrap_cell_coord(const Frame& frame, ivec3 cell_coord) {
+    const ivec3 n = frame.cell_count;
+    return {((cell_coord.x % n.x) + n.x) % n.x, ((cell_coord.y % n.y) + n.y) % n.y, ((cell_coord.z % n.z) + n.z) % n.z};
+}
+
+// Cell coordinate within a periodic frame, coordinates outside of the box are wrapped into it
+inline ivec3 compute_periodic_cell_coord(const Frame& frame, vec3 coord) {
+    return wrap_cell_coord(frame, ivec3(math::floor((coord - frame.min_box) / frame.cell_ext)));
+}
+
 inline Cell get_cell(const Frame& frame, ivec3 cell_coord) {
     int idx = compute_cell_idx(frame, cell_coord);
     ASSERT(idx < frame.cells.size());
     return frame.cells[idx];
 }
 
-inline Array<const Entry> get_cell_entries(const Frame& frame, ivec3 cell_coord) {
-    Cell cell = get_cell(frame, cell_coord);
-    return {frame.entries.beg() + cell.offset, cell.count};
+inline vec3 get_entry_position(const Frame& frame, i32 entry) { return {frame.entry_x[entry], frame.entry_y[entry], frame.entry_z[entry]}; }
+
+// Maximum number of hits which are gathered before the callback of for_each_entry_within is invoked
+constexpr i32 HIT_BUFFER_SIZE = 64;
+
+// Tests the entries [beg, end) of the frame against coord, SIMD_WIDTH entries at a time, and invokes func(entry) for every entry closer than sqrt(r2).
+// The hits of each vector are compressed into a buffer of entry indices, which keeps the callback out of the distance tests.
+// Distances within periodic frames follow the minimum image convention.
+template <typename Func>
+void for_each_entry_within(const Frame& frame, i32 beg, i32 end, vec3 coord, float r2, Func func) {
+    const bool periodic = is_periodic(frame);
+    const float* x = frame.entry_x.data();
+    const float* y = frame.entry_y.data();
+    const float* z = frame.entry_z.data();
+    const SIMD_TYPE_F cx = SIMD_SET_F(coord.x);
+    const SIMD_TYPE_F cy = SIMD_SET_F(coord.y);
+    const SIMD_TYPE_F cz = SIMD_SET_F(coord.z);
+    const SIMD_TYPE_F px = SIMD_SET_F(frame.period.x);
+    const SIMD_TYPE_F py = SIMD_SET_F(frame.period.y);
+    const SIMD_TYPE_F pz = SIMD_SET_F(frame.period.z);
+    const SIMD_TYPE_F max_d2 = SIMD_SET_F(r2);
+
+    i32 hits[HIT_BUFFER_SIZE];
+    i32 num_hits = 0;
+    for (i32 i = beg; i < end; i += SIMD_WIDTH) {
+        SIMD_TYPE_F dx = simd::sub(SIMD_LOAD_F(x + i), cx);
+        SIMD_TYPE_F dy = simd::sub(SIMD_LOAD_F(y + i), cy);
+        SIMD_TYPE_F dz = simd::sub(SIMD_LOAD_F(z + i), cz);
+        if (periodic) {
+            dx = simd::sub(dx, simd::mul(px, simd::round(simd::div(dx, px))));
+            dy = simd::sub(dy, simd::mul(py, simd::round(simd::div(dy, py))));
+            dz = simd::sub(dz, simd::mul(pz, simd::round(simd::div(dz, pz))));
+        }
+        const SIMD_TYPE_F d2 = simd::add(simd::add(simd::mul(dx, dx), simd::mul(dy, dy)), simd::mul(dz, dz));
+
+        u32 mask = (u32)simd::move_mask(simd::cmp_lt(d2, max_d2));
+        if (end - i < SIMD_WIDTH) mask &= (1U << (end - i)) - 1;  // Lanes past the end of the range
+        while (mask) {
+            hits[num_hits++] = i + (i32)ctz(mask);
+            mask &= mask - 1;
+        }
+
+        if (num_hits > HIT_BUFFER_SIZE - SIMD_WIDTH) {
+            for (i32 j = 0; j < num_hits; j++) func(hits[j]);
+            num_hits = 0;
+        }
+    }
+    for (i32 j = 0; j < num_hits; j++) func(hits[j]);
 }
 
-inline DynamicArray<int> query_indices(const Frame& frame, vec3 coord, float radius) {
+// Neighbor search within a periodic frame, the cells wrap around the box and distances follow the minimum image convention.
+// cb receives the position of the minimum image of each entry relative to coord, i.e. the entry position shifted by a multiple of the box extent.
+// @NOTE: radius should not exceed half of the box extent, only the closest image of each entry is considered.
+template <typename Callback>
+void for_each_within_periodic(const Frame& frame, vec3 coord, float radius, Callback cb) {
+    ASSERT(is_periodic(frame));
     const float r2 = radius * radius;
-    ivec3 min_cc = compute_cell_coord(frame, coord - radius);
-    ivec3 max_cc = compute_cell_coord(frame, coord + radius);
+    const ivec3 min_cc = ivec3(math::floor((coord - radius - frame.min_box) / frame.cell_ext));
+    // Each cell is visited at most once, even if the search extent spans the whole box
+    const ivec3 max_cc = math::min(ivec3(math::floor((coord + radius - frame.min_box) / frame.cell_ext)), min_cc + frame.cell_count - 1);
     ivec3 cc;
-    DynamicArray<int> res;
     for (cc.z = min_cc.z; cc.z <= max_cc.z; cc.z++) {
         for (cc.y = min_cc.y; cc.y <= max_cc.y; cc.y++) {
             for (cc.x = min_cc.x; cc.x <= max_cc.x; cc.x++) {
-                for (const auto& e : get_cell_entries(frame, cc)) {
-                    if (math::distance2(coord, e.position) < r2) {
-                        res.push_back(e.index);
-                    }
-                }
+                const Cell cell = get_cell(frame, wrap_cell_coord(frame, cc));
+                for_each_entry_within(frame, cell.offset, cell.offset + cell.count, coord, r2, [&frame, &coord, &cb](i32 entry) {
+                    vec3 d = get_entry_position(frame, entry) - coord;
+                    d -= frame.period * math::round(d / frame.period);
+                    cb(frame.entry_index[entry], coord + d);
+                });
             }
         }
     }
-    return res;
 }
 
 template <typename Callback>
 void for_each_within(const Frame& frame, vec3 coord, float radius, Callback cb) {
+    if (is_periodic(frame)) {
+        for_each_within_periodic(frame, coord, radius, cb);
+        return;
+    }
     const float r2 = radius * radius;
     const ivec3 min_cc = compute_cell_coord(frame, coord - radius);
     const ivec3 max_cc = compute_cell_coord(frame, coord + radius);
@@ -80,23 +156,46 @@ void for_each_within(const Frame& frame, vec3 coord, float radius, Callback cb)
     for (cc.z = min_cc.z; cc.z <= max_cc.z; cc.z++) {
         for (cc.y = min_cc.y; cc.y <= max_cc.y; cc.y++) {
             for (cc.x = min_cc.x; cc.x <= max_cc.x; cc.x++) {
-                for (const auto& e : get_cell_entries(frame, cc)) {
-                    if (math::distance2(coord, e.position) < r2) {
-                        cb(e.index, e.position);
-                    }
-                }
+                const Cell cell = get_cell(frame, cc);
+                for_each_entry_within(frame, cell.offset, cell.offset + cell.count, coord, r2,
+                                      [&frame, &cb](i32 entry) { cb(frame.entry_index[entry], get_entry_position(frame, entry)); });
             }
         }
     }
 }
 
-Frame compute_frame(const float* pos_x, const float* pos_y, const float* pos_z, i64 count, const vec3& cell_ext);
-void compute_frame(Frame* frame, const float* pos_x, const float* pos_y, const float* pos_z, i64 count, const vec3& cell_ext);
-inline void compute_frame(Frame* frame, const soa_vec3& in_positions, i64 count, const vec3& cell_ext) {
-    return compute_frame(frame, in_positions.x, in_positions.y, in_positions.z, count, cell_ext);
+inline DynamicArray<int> query_indices(const Frame& frame, vec3 coord, float radius) {
+    DynamicArray<int> res;
+    for_each_within(frame, coord, radius, [&res](int idx, const vec3& pos) {
+        (void)pos;
+        res.push_back(idx);
+    });
+    return res;
+}
+
+// Builds the frame with a counting sort of the entries into the cells, entries within a cell keep their input order.
+// The build is distributed over num_threads threads (<= 0 uses all hardware threads), small frames are built on the calling thread.
+// The result is identical regardless of the number of threads.
+Frame compute_frame(const float* pos_x, const float* pos_y, const float* pos_z, i64 count, const vec3& cell_ext, i32 num_threads = 0);
+
+// Rebuilds an existing frame, the memory of the frame is reused across rebuilds and only grows if needed
+void compute_frame(Frame* frame, const float* pos_x, const float* pos_y, const float* pos_z, i64 count, const vec3& cell_ext, i32 num_threads = 0);
+inline void compute_frame(Frame* frame, const soa_vec3& in_positions, i64 count, const vec3& cell_ext, i32 num_threads = 0) {
+    return compute_frame(frame, in_positions.x, in_positions.y, in_positions.z, count, cell_ext, num_threads);
 }
 
-Frame compute_frame(const float* pos_x, const float* pos_y, const float* pos_z, i64 count, const vec3& cell_ext, const vec3& min_box, const vec3& max_box);
-void compute_frame(Frame* frame, const float* pos_x, const float* pos_y, const float* pos_z, i64 count, const vec3& cell_ext, const vec3& min_box, const vec3& max_box);
+Frame compute_frame(const float* pos_x, const float* pos_y, const float* pos_z, i64 count, const vec3& cell_ext, const vec3& min_box, const vec3& max_box,
+                    i32 num_threads = 0);
+void compute_frame(Frame* frame, const float* pos_x, const float* pos_y, const float* pos_z, i64 count, const vec3& cell_ext, const vec3& min_box,
+                   const vec3& max_box, i32 num_threads = 0);
+
+// Builds a periodic frame over the simulation box (e.g. TrajectoryFrame::box) with the origin at zero, positions outside of the box are wrapped into it.
+// The cell extent is rounded up so that the cells tile the box exactly. Queries are answered with for_each_within_periodic.
+// @NOTE: Only rectangular boxes are supported, the extent is taken from the diagonal of the box like in apply_pbc.
+void compute_frame_periodic(Frame* frame, const float* pos_x, const float* pos_y, const float* pos_z, i64 count, const vec3& cell_ext, const mat3& box,
+                            i32 num_threads = 0);
+inline void compute_frame_periodic(Frame* frame, const soa_vec3& in_positions, i64 count, const vec3& cell_ext, const mat3& box, i32 num_threads = 0) {
+    return compute_frame_periodic(frame, in_positions.x, in_positions.y, in_positions.z, count, cell_ext, box, num_threads);
+}
 
 }  // namespace spatialhash
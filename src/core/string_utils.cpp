@@ -1,6 +1,9 @@
 ﻿#include "string_utils.h"
 #include <core/common.h>
 #include <core/log.h>
+#include <core/sync.h>
+#include <core/simd.h>
+#include <core/intrinsics.h>
 #include <ctype.h>
 
 #ifdef WIN32
@@ -119,7 +122,7 @@ CStringView extract_line(CStringView& str) {
     while (str_beg != str_end && (*str_beg == '\r' || *str_beg == '\n')) ++str_beg;
 
     const char* line_beg = str_beg;
-    const char* line_end = (const char*)memchr(str_beg, '\n', str.length());
+    const char* line_end = (const char*)memchr(str_beg, '\n', str_end - str_beg);
     if (!line_end) {
         line_end = str_end;
         str_beg = str_end;
@@ -139,6 +142,211 @@ CStringView extract_line(CStringView& str) {
     return {line_beg, line_end};
 }
 
+// Appends the line [beg, end) with the same pruning as extract_line, empty lines are skipped
+static inline bool push_line(CStringView* lines, i64* count, const char* beg, const char* end) {
+    while (beg != end && *beg == '\r') ++beg;
+    while (end != beg && *(end - 1) == '\r') --end;
+    if (beg == end) return false;
+    lines[(*count)++] = {beg, end - beg};
+    return true;
+}
+
+i64 extract_lines(CStringView* lines, i64 capacity, CStringView& str) {
+    ASSERT(lines);
+    const char* line_beg = str.beg();
+    const char* const str_end = str.end();
+    i64 count = 0;
+
+#if defined(__AVX2__)
+    constexpr i64 block_size = 32;
+    const __m256i newline = _mm256_set1_epi8('\n');
+#else
+    constexpr i64 block_size = 16;
+    const __m128i newline = _mm_set1_epi8('\n');
+#endif
+
+    // @NOTE: A block may hold several line breaks, all of them are extracted from the same compare mask
+    const char* c = line_beg;
+    while (count < capacity && str_end - c >= block_size) {
+#if defined(__AVX2__)
+        u32 mask = (u32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)c), newline));
+#else
+        u32 mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)c), newline));
+#endif
+        while (mask && count < capacity) {
+            const char* line_end = c + ctz(mask);
+            push_line(lines, &count, line_beg, line_end);
+            line_beg = line_end + 1;
+            mask &= mask - 1;
+        }
+        if (count == capacity) break;
+        c += block_size;
+    }
+
+    // Remainder
+    while (count < capacity && line_beg < str_end) {
+        const char* line_end = (const char*)memchr(line_beg, '\n', str_end - line_beg);
+        if (!line_end) line_end = str_end;
+        push_line(lines, &count, line_beg, line_end);
+        line_beg = line_end == str_end ? str_end : line_end + 1;
+    }
+
+    if (line_beg > str_end) line_beg = str_end;
+    str = {line_beg, str_end - line_beg};
+    return count;
+}
+
+// The batch float parser needs SSE2 only, SSSE3 (pshufb, pmaddubsw) shortens the removal of the decimal point and the digit reduction
+#if defined(__SSSE3__) || defined(__AVX__)
+// pshufb controls which drop the decimal point at index p of an 8 byte field (starting at byte offset) by shifting the preceding characters
+// one step towards it, leaving a leading zero. Entry 8 (no decimal point) is the identity.
+static constexpr u64 dot_shuffle(int p, int offset) {
+    u64 ctrl = 0;
+    for (int j = 0; j < 8; j++) {
+        const u64 src = j == 0 && p < 8 ? 0x80 : offset + (j <= p && p < 8 ? j - 1 : j);
+        ctrl |= src << (j * 8);
+    }
+    return ctrl;
+}
+
+static constexpr u64 dot_shuffle_table[2][9] = {
+    {dot_shuffle(0, 0), dot_shuffle(1, 0), dot_shuffle(2, 0), dot_shuffle(3, 0), dot_shuffle(4, 0), dot_shuffle(5, 0), dot_shuffle(6, 0), dot_shuffle(7, 0), dot_shuffle(8, 0)},
+    {dot_shuffle(0, 8), dot_shuffle(1, 8), dot_shuffle(2, 8), dot_shuffle(3, 8), dot_shuffle(4, 8), dot_shuffle(5, 8), dot_shuffle(6, 8), dot_shuffle(7, 8), dot_shuffle(8, 8)}};
+#else
+// Byte masks which drop the decimal point at index p of an 8 byte field without pshufb: the characters in front of it are taken from the field
+// shifted one byte towards it (shift_mask) and the ones behind it from the field itself (keep_mask), leaving a leading zero.
+// Entry 8 (no decimal point) keeps the field as is.
+static constexpr u64 dot_shift_mask(int p) {
+    u64 mask = 0;
+    for (int j = 1; j <= p && j < 8; j++) mask |= 0xFFull << (j * 8);
+    return p < 8 ? mask : 0;
+}
+
+static constexpr u64 dot_keep_mask(int p) {
+    u64 mask = 0;
+    for (int j = p + 1; j < 8; j++) mask |= 0xFFull << (j * 8);
+    return p < 8 ? mask : ~0ull;
+}
+
+static constexpr u64 dot_shift_mask_table[9] = {dot_shift_mask(0), dot_shift_mask(1), dot_shift_mask(2), dot_shift_mask(3), dot_shift_mask(4),
+                                                dot_shift_mask(5), dot_shift_mask(6), dot_shift_mask(7), dot_shift_mask(8)};
+static constexpr u64 dot_keep_mask_table[9] = {dot_keep_mask(0), dot_keep_mask(1), dot_keep_mask(2), dot_keep_mask(3), dot_keep_mask(4),
+                                               dot_keep_mask(5), dot_keep_mask(6), dot_keep_mask(7), dot_keep_mask(8)};
+#endif
+
+// Scale of the integer formed by the digits of a field with the decimal point at index p (8 if there is none)
+static constexpr float inv_pow10_table[9] = {1e-7f, 1e-6f, 1e-5f, 1e-4f, 1e-3f, 1e-2f, 1e-1f, 1e0f, 1e0f};
+
+// Validates the layout of an 8 character field from its character class masks and returns the index of the decimal point (8 if there is none),
+// -1 if the field does not match the pattern [spaces][-][digits][.][digits]
+static inline int classify_field(u32 valid, u32 space, u32 minus, u32 dot) {
+    if (valid != 0xFF) return -1;
+    if (space & (space + 1)) return -1;                 // Spaces are only allowed as leading padding
+    if (minus && minus != space + 1) return -1;         // The sign has to directly follow the padding
+    if (dot & (dot - 1)) return -1;                     // At most one decimal point
+    if ((space | minus | dot) == 0xFF) return -1;       // No digits
+    return dot ? (int)ctz(dot) : 8;
+}
+
+// Field [column, column + width) of line, clamped to the extent of the line
+static inline CStringView get_field(CStringView line, i32 column, i32 width) {
+    if (line.length() <= column) return {};
+    return line.substr(column, MIN((i64)width, line.length() - column));
+}
+
+void parse_fixed_width_floats(float* out, const CStringView* lines, i64 count, i32 column, i32 width, float scale) {
+    ASSERT(out);
+    ASSERT(lines);
+    i64 i = 0;
+
+    if (0 < width && width <= 8) {
+        const __m128i zero_char = _mm_set1_epi8('0');
+        const __m128i nine_char = _mm_set1_epi8('9');
+        const __m128i space_char = _mm_set1_epi8(' ');
+        const __m128i minus_char = _mm_set1_epi8('-');
+        const __m128i dot_char = _mm_set1_epi8('.');
+#if defined(__SSSE3__) || defined(__AVX__)
+        const __m128i w10 = _mm_set1_epi16(0x010A);     // Byte pairs (10, 1)
+#else
+        const __m128i w10 = _mm_set1_epi32(0x0001000A);  // Word pairs (10, 1)
+#endif
+        const __m128i w100 = _mm_set1_epi32(0x00010064);  // Word pairs (100, 1)
+        const __m128i w10000 = _mm_set1_epi32(0x00012710);  // Word pairs (10000, 1)
+
+        for (; i + 1 < count; i += 2) {
+            const CStringView& line_a = lines[i + 0];
+            const CStringView& line_b = lines[i + 1];
+            if (line_a.length() < column + width || line_b.length() < column + width) {
+                out[i + 0] = str_to_float(get_field(line_a, column, width)) * scale;
+                out[i + 1] = str_to_float(get_field(line_b, column, width)) * scale;
+                continue;
+            }
+
+            __m128i v;
+            if (width == 8) {
+                v = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(line_a.beg() + column)), _mm_loadl_epi64((const __m128i*)(line_b.beg() + column)));
+            } else {
+                // Right align both fields within 8 characters, padded with spaces
+                alignas(16) char buf[16];
+                memset(buf, ' ', sizeof(buf));
+                memcpy(buf + 8 - width, line_a.beg() + column, width);
+                memcpy(buf + 16 - width, line_b.beg() + column, width);
+                v = _mm_load_si128((const __m128i*)buf);
+            }
+
+            const __m128i is_digit = _mm_andnot_si128(_mm_or_si128(_mm_cmplt_epi8(v, zero_char), _mm_cmpgt_epi8(v, nine_char)), _mm_set1_epi8(-1));
+            const __m128i is_space = _mm_cmpeq_epi8(v, space_char);
+            const __m128i is_minus = _mm_cmpeq_epi8(v, minus_char);
+            const __m128i is_dot = _mm_cmpeq_epi8(v, dot_char);
+            const u32 valid = (u32)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(is_digit, is_space), _mm_or_si128(is_minus, is_dot)));
+            const u32 space = (u32)_mm_movemask_epi8(is_space);
+            const u32 minus = (u32)_mm_movemask_epi8(is_minus);
+            const u32 dot = (u32)_mm_movemask_epi8(is_dot);
+
+            const int p_a = classify_field(valid & 0xFF, space & 0xFF, minus & 0xFF, dot & 0xFF);
+            const int p_b = classify_field(valid >> 8, space >> 8, minus >> 8, dot >> 8);
+            if (p_a < 0 || p_b < 0) {
+                out[i + 0] = str_to_float(get_field(line_a, column, width)) * scale;
+                out[i + 1] = str_to_float(get_field(line_b, column, width)) * scale;
+                continue;
+            }
+
+            // Remove the decimal points, which leaves the digits of each field as an 8 digit integer
+#if defined(__SSSE3__) || defined(__AVX__)
+            const __m128i ctrl = _mm_set_epi64x((i64)dot_shuffle_table[1][p_b], (i64)dot_shuffle_table[0][p_a]);
+            const __m128i s = _mm_shuffle_epi8(v, ctrl);
+#else
+            const __m128i shift_mask = _mm_set_epi64x((i64)dot_shift_mask_table[p_b], (i64)dot_shift_mask_table[p_a]);
+            const __m128i keep_mask = _mm_set_epi64x((i64)dot_keep_mask_table[p_b], (i64)dot_keep_mask_table[p_a]);
+            const __m128i s = _mm_or_si128(_mm_and_si128(_mm_slli_si128(v, 1), shift_mask), _mm_and_si128(v, keep_mask));
+#endif
+
+            // Everything which is not a digit (padding, sign) counts as zero
+            const __m128i s_digit = _mm_andnot_si128(_mm_or_si128(_mm_cmplt_epi8(s, zero_char), _mm_cmpgt_epi8(s, nine_char)), _mm_set1_epi8(-1));
+            const __m128i d = _mm_and_si128(_mm_sub_epi8(s, zero_char), s_digit);
+
+#if defined(__SSSE3__) || defined(__AVX__)
+            __m128i t = _mm_maddubs_epi16(d, w10);   // 2 digits per 16-bit lane
+#else
+            const __m128i zero = _mm_setzero_si128();
+            __m128i t = _mm_packs_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(d, zero), w10), _mm_madd_epi16(_mm_unpackhi_epi8(d, zero), w10));  // 2 digits per 16-bit lane
+#endif
+            t = _mm_madd_epi16(t, w100);             // 4 digits per 32-bit lane
+            t = _mm_packs_epi32(t, t);
+            t = _mm_madd_epi16(t, w10000);           // 8 digits per 32-bit lane, [a, b, a, b]
+
+            const float s_a = (minus & 0xFF) ? -scale : scale;
+            const float s_b = (minus >> 8) ? -scale : scale;
+            const __m128 f = _mm_mul_ps(_mm_cvtepi32_ps(t), _mm_setr_ps(inv_pow10_table[p_a] * s_a, inv_pow10_table[p_b] * s_b, 0, 0));
+            _mm_storel_pi((__m64*)(out + i), f);
+        }
+    }
+
+    for (; i < count; i++) {
+        out[i] = str_to_float(get_field(lines[i], column, width)) * scale;
+    }
+}
+
 /*
 bool copy_line(String& line, CString& str) {
     const char* str_beg = str.data;
@@ -324,6 +532,65 @@ DynamicArray<i64> find_patterns_in_file(CStringView filename, CStringView patter
     return offsets;
 }
 
+bool find_patterns_in_file_parallel(DynamicArray<i64>* offsets, CStringView filename, CStringView pattern, i32 num_threads) {
+    ASSERT(offsets);
+    offsets->clear();
+    if (pattern.count == 0) return true;
+
+    MappedFile file;
+    if (!map_file(&file, filename)) {
+        LOG_ERROR("Could not open file '%.*s'", (int)filename.length(), filename.beg());
+        return false;
+    }
+    defer { unmap_file(&file); };
+
+    // @NOTE: Small files are not worth the thread overhead
+    constexpr i64 min_bytes_per_thread = MEGABYTES(4);
+    num_threads = get_num_threads(num_threads);
+    num_threads = (i32)MIN((i64)num_threads, MAX(file.size / min_bytes_per_thread, (i64)1));
+
+    // find_pattern_in_string operates on 32-bit sizes, so each thread range is searched in chunks well below 4GB
+    constexpr i64 max_chunk_size = GIGABYTES(1);
+
+    DynamicArray<i64>* results = (DynamicArray<i64>*)TMP_MALLOC(num_threads * sizeof(DynamicArray<i64>));
+    defer { TMP_FREE(results); };
+    for (i32 i = 0; i < num_threads; i++) PLACEMENT_NEW(results + i) DynamicArray<i64>();
+
+    run_on_threads(num_threads, [&](i32 thread_idx) {
+        const i64 range_beg = file.size * thread_idx / num_threads;
+        const i64 range_end = file.size * (thread_idx + 1) / num_threads;
+        for (i64 chunk_beg = range_beg; chunk_beg < range_end; chunk_beg += max_chunk_size) {
+            const i64 chunk_end = MIN(chunk_beg + max_chunk_size, range_end);
+            // Overlap with the next chunk so that patterns which straddle the border are found, but only patterns starting within the chunk are kept
+            const i64 search_end = MIN(chunk_end + pattern.size_in_bytes() - 1, file.size);
+            CStringView str = {file.data + chunk_beg, file.data + search_end};
+            while (CStringView match = find_pattern_in_string(str, pattern)) {
+                const i64 offset = (i64)(match.beg() - file.data);
+                if (offset >= chunk_end) break;
+                results[thread_idx].push_back(offset);
+                str = {match.end(), str.end()};
+            }
+        }
+    });
+
+    // Thread ranges are ascending and disjoint, so concatenating them keeps the offsets sorted
+    i64 count = 0;
+    for (i32 i = 0; i < num_threads; i++) count += results[i].size();
+    offsets->reserve(count);
+    for (i32 i = 0; i < num_threads; i++) {
+        offsets->append(results[i]);
+        results[i].~DynamicArray();
+    }
+
+    return true;
+}
+
+DynamicArray<i64> find_patterns_in_file_parallel(CStringView filename, CStringView pattern, i32 num_threads) {
+    DynamicArray<i64> offsets;
+    find_patterns_in_file_parallel(&offsets, filename, pattern, num_threads);
+    return offsets;
+}
+
 CStringView get_directory(CStringView url) {
     if (url.count == 0) {
         return url;
@@ -524,6 +791,18 @@ CStringView extract_parentheses_contents(CStringView str) {
 CStringView find_pattern_in_string(CStringView target, CStringView pattern) {
     if (pattern.count == 0 || target.count < pattern.count) return {};
 
+    // @NOTE: The short haystack path (< 777 bytes) of Railgun_Trolldom hashes the pattern through 'unsigned long', which is 8 bytes on LP64 platforms,
+    // so it misses matches there. Short haystacks are searched with a plain scan instead.
+    if (target.count < 777) {
+        const char* last = target.end() - pattern.count;
+        for (const char* c = target.beg(); c <= last; c++) {
+            c = (const char*)memchr(c, pattern[0], last - c + 1);
+            if (!c) break;
+            if (memcmp(c, pattern.beg(), pattern.count) == 0) return {c, pattern.length()};
+        }
+        return {};
+    }
+
     char* ptr = Railgun_Trolldom((char*)target.cstr(), (char*)pattern.cstr(), (u32)target.size_in_bytes(), (u32)pattern.size_in_bytes());
     if (ptr) {
         return {(char*)ptr, pattern.length()};
@@ -1,9 +1,13 @@
 #pragma once
 
 #include <core/platform.h>
+#include <core/types.h>
+#include <core/common.h>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
 #include <semaphore>
+#include <thread>
 
 using std::atomic_int32_t;
 using std::atomic_uint32_t;
@@ -20,9 +24,41 @@ using std::atomic_fetch_xor;
 using std::atomic_exchange;
 
 using std::mutex;
+using std::condition_variable;
 
 using std::counting_semaphore;
 
+using std::thread;
+
+// Resolves a requested thread count, where num_threads <= 0 means one thread per hardware thread
+inline i32 get_num_threads(i32 num_threads = 0) {
+    if (num_threads > 0) return num_threads;
+    const i32 hw_threads = (i32)thread::hardware_concurrency();
+    return hw_threads > 0 ? hw_threads : 1;
+}
+
+// Executes func(thread_idx) on num_threads threads and blocks until all of them are done.
+// The calling thread participates as thread_idx 0.
+template <typename Func>
+void run_on_threads(i32 num_threads, Func func) {
+    if (num_threads <= 1) {
+        func(0);
+        return;
+    }
+
+    thread* threads = (thread*)TMP_MALLOC((num_threads - 1) * sizeof(thread));
+    defer { TMP_FREE(threads); };
+
+    for (i32 i = 1; i < num_threads; i++) {
+        PLACEMENT_NEW(threads + i - 1) thread(func, i);
+    }
+    func(0);
+    for (i32 i = 1; i < num_threads; i++) {
+        threads[i - 1].join();
+        threads[i - 1].~thread();
+    }
+}
+
 /*
 #if PLATFORM_WINDOWS
 
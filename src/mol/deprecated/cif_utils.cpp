@@ -0,0 +1,467 @@
+#include "cif_utils.h"
+#include <mol/element_utils.h>
+#include <core/string_utils.h>
+#include <core/log.h>
+#include <core/file.h>
+#include <core/sync.h>
+
+#include <string.h>
+
+namespace cif {
+
+// The _atom_site items which are extracted, the remaining items of the loop are skipped
+enum AtomSiteField : i32 { TypeSymbol, AtomId, CompId, AsymId, SeqId, InsCode, CartnX, CartnY, CartnZ, ModelNum, NumFields };
+
+struct ItemMapping {
+    CStringView name;
+    AtomSiteField field;
+    i32 priority;  // The author provided items are preferred, since they match the identifiers of the corresponding pdb entry
+};
+
+static constexpr ItemMapping item_mappings[] = {
+    {"type_symbol", TypeSymbol, 1},
+    {"label_atom_id", AtomId, 1},
+    {"auth_atom_id", AtomId, 2},
+    {"label_comp_id", CompId, 1},
+    {"auth_comp_id", CompId, 2},
+    {"label_asym_id", AsymId, 1},
+    {"auth_asym_id", AsymId, 2},
+    {"label_seq_id", SeqId, 1},
+    {"auth_seq_id", SeqId, 2},
+    {"pdbx_PDB_ins_code", InsCode, 1},
+    {"Cartn_x", CartnX, 1},
+    {"Cartn_y", CartnY, 1},
+    {"Cartn_z", CartnZ, 1},
+    {"pdbx_PDB_model_num", ModelNum, 1},
+};
+
+// Columns beyond this are not mapped to fields, but are still counted to validate the rows
+constexpr i32 MAX_COLUMNS = 64;
+
+// Bytes per thread below which it is not worth spawning another thread
+constexpr i64 MIN_CHUNK_SIZE = MEGABYTES(1);
+
+struct AtomSiteLoop {
+    CStringView body;                // From the first row until the end of the string, the end of the loop is found while counting the rows
+    i32 num_columns = 0;
+    i8 column_field[MAX_COLUMNS];   // Field of each column, -1 if the column is skipped
+};
+
+struct RowKey {
+    CStringView comp;
+    CStringView asym;
+    CStringView ins;
+    int seq_id = 0;
+    int model = 0;
+};
+
+// Per thread chunk of the loop body, chunks start and end on line boundaries
+struct Chunk {
+    const char* beg = nullptr;
+    const char* end = nullptr;
+    bool terminated = false;  // The loop ends within this chunk, end has been moved to the terminating line
+    bool valid = true;
+    i64 num_rows = 0;
+    i64 row_offset = 0;
+    i64 num_model_rows = 0;   // Rows which belong to the first model
+    i64 num_residues = 0;
+    i64 num_chains = 0;
+    i64 residue_offset = 0;
+    i64 chain_offset = 0;
+};
+
+enum RowFlags : u8 { NewResidue = 1, NewChain = 2 };
+
+// Returns the next non-blank line within [c, end) without its leading whitespace, empty if there is none
+inline CStringView next_row(const char*& c, const char* end) {
+    while (c < end) {
+        const char* nl = (const char*)memchr(c, '\n', end - c);
+        const char* line_end = nl ? nl : end;
+        const char* line_beg = c;
+        c = nl ? nl + 1 : end;
+        while (line_beg != line_end && is_whitespace(*line_beg)) line_beg++;
+        if (line_beg != line_end) return {line_beg, line_end};
+    }
+    return {};
+}
+
+// Returns the last non-blank line which ends before c
+inline CStringView prev_row(const char* c, const char* beg) {
+    while (c > beg && is_whitespace(c[-1])) c--;
+    const char* line_end = c;
+    while (c > beg && c[-1] != '\n') c--;
+    return next_row(c, line_end);
+}
+
+// Reserved words and the start of another category or a comment terminate the loop.
+// Values which start with any of these have to be quoted, so a row can never be mistaken for a terminator.
+inline bool is_loop_terminator(CStringView row) {
+    const char c = row[0];
+    if (c == '#' || c == '_') return true;
+    return compare_n_ignore_case(row, "loop_", 5) || compare_n_ignore_case(row, "data_", 5) || compare_n_ignore_case(row, "save_", 5) ||
+           compare_n_ignore_case(row, "stop_", 5) || compare_n_ignore_case(row, "global_", 7);
+}
+
+// Splits a row into its values and stores the values of the mapped columns in fields, quoted values are stored without their quotes.
+// Returns the number of values within the row.
+static i32 tokenize_row(CStringView* fields, const AtomSiteLoop& loop, CStringView row) {
+    const char* c = row.beg();
+    const char* end = row.end();
+    i32 count = 0;
+    while (true) {
+        while (c != end && is_whitespace(*c)) c++;
+        if (c == end) break;
+
+        const char* token_beg = c;
+        const char* token_end;
+        if (*c == '\'' || *c == '"') {
+            // A quoted value ends at a matching quote which is followed by whitespace
+            const char quote = *c++;
+            token_beg = c;
+            while (c != end && !(*c == quote && (c + 1 == end || is_whitespace(c[1])))) c++;
+            token_end = c;
+            if (c != end) c++;
+        } else {
+            while (c != end && !is_whitespace(*c)) c++;
+            token_end = c;
+        }
+
+        if (count < loop.num_columns && count < MAX_COLUMNS && loop.column_field[count] != -1) {
+            fields[loop.column_field[count]] = {token_beg, token_end};
+        }
+        count++;
+    }
+    return count;
+}
+
+// '.' and '?' denote omitted and unknown values
+inline bool is_null(CStringView value) { return value.length() == 1 && (value[0] == '.' || value[0] == '?'); }
+
+inline RowKey extract_key(const CStringView* fields) {
+    RowKey key;
+    key.comp = fields[CompId];
+    key.asym = fields[AsymId];
+    key.ins = is_null(fields[InsCode]) ? CStringView() : fields[InsCode];
+    key.seq_id = is_null(fields[SeqId]) ? 0 : to_int(fields[SeqId]);
+    key.model = fields[ModelNum] ? to_int(fields[ModelNum]) : 0;
+    return key;
+}
+
+// @NOTE: compare() treats empty strings as different, absent values should be considered equal here
+inline bool same_value(CStringView a, CStringView b) { return a.length() == b.length() && (a.length() == 0 || compare(a, b)); }
+
+inline u8 compare_keys(const RowKey& prev, const RowKey& cur) {
+    if (!same_value(prev.asym, cur.asym)) return NewChain | NewResidue;
+    if (prev.seq_id != cur.seq_id || !same_value(prev.comp, cur.comp) || !same_value(prev.ins, cur.ins)) return NewResidue;
+    return 0;
+}
+
+static bool find_atom_site_loop(AtomSiteLoop* loop, CStringView str) {
+    CStringView item = find_pattern_in_string(str, "_atom_site.");
+    if (!item) {
+        LOG_ERROR("mmCIF does not contain any _atom_site items");
+        return false;
+    }
+
+    // The items have to be preceded by loop_, a single atom would be stored as a list of key value pairs which is not supported
+    CStringView before = prev_row(item.beg(), str.beg());
+    if (!before || !compare_n_ignore_case(before, "loop_", 5)) {
+        LOG_ERROR("mmCIF _atom_site is not a loop");
+        return false;
+    }
+
+    memset(loop->column_field, -1, sizeof(loop->column_field));
+    i32 field_priority[NumFields] = {};
+    i32 num_columns = 0;
+
+    const char* c = item.beg();
+    const char* end = str.end();
+    const char* body_beg = c;
+    CStringView row;
+    while ((row = next_row(c, end)) && compare_n(row, "_atom_site.", 11)) {
+        CStringView name = row.substr(11);
+        const char* name_end = name.beg();
+        while (name_end != name.end() && !is_whitespace(*name_end)) name_end++;
+        name = {name.beg(), name_end};
+
+        if (num_columns < MAX_COLUMNS) {
+            for (const ItemMapping& m : item_mappings) {
+                if (m.priority > field_priority[m.field] && compare(name, m.name)) {
+                    // Release the column of a lower priority item which was mapped to the same field
+                    for (i32 i = 0; i < num_columns; i++) {
+                        if (loop->column_field[i] == m.field) loop->column_field[i] = -1;
+                    }
+                    loop->column_field[num_columns] = (i8)m.field;
+                    field_priority[m.field] = m.priority;
+                    break;
+                }
+            }
+        }
+        num_columns++;
+        body_beg = c;
+    }
+
+    if (!field_priority[CartnX] || !field_priority[CartnY] || !field_priority[CartnZ] || !field_priority[AtomId]) {
+        LOG_ERROR("mmCIF _atom_site is missing required items (Cartn_x, Cartn_y, Cartn_z, atom_id)");
+        return false;
+    }
+
+    loop->body = {body_beg, end};
+    loop->num_columns = num_columns;
+    return true;
+}
+
+// True if the row at row_beg is a valid row of the given model
+static bool is_model_row(const AtomSiteLoop& loop, const char* row_beg, const char* end, i32 model) {
+    const CStringView row = next_row(row_beg, end);
+    if (!row || is_loop_terminator(row)) return false;
+    CStringView fields[NumFields] = {};
+    return tokenize_row(fields, loop, row) == loop.num_columns && extract_key(fields).model == model;
+}
+
+// Returns the end of the rows of the model which starts the body, i.e. the start of the first row which belongs to another model or ends the loop.
+// Models are stored one after another, so instead of visiting every row, the byte range is bisected on the model of the row at the midpoint.
+static const char* find_model_end(const AtomSiteLoop& loop, CStringView body, i32 model) {
+    // lo is the start of a row of the model, hi the start of a row beyond it (or the end of the body)
+    const char* lo = body.beg();
+    const char* hi = body.end();
+    while (true) {
+        const char* mid = lo + (hi - lo) / 2;
+        const char* nl = (const char*)memchr(mid, '\n', hi - mid);
+        if (!nl || nl + 1 >= hi) break;
+        mid = nl + 1;
+        if (is_model_row(loop, mid, body.end(), model)) lo = mid;
+        else hi = mid;
+    }
+
+    // The rows which start between lo and the midpoint are left, which are only a few
+    const char* c = lo;
+    next_row(c, hi);
+    while (c < hi) {
+        if (!is_model_row(loop, c, body.end(), model)) return c;
+        next_row(c, hi);
+    }
+    return hi;
+}
+
+bool load_molecule_from_file(MoleculeStructure* mol, CStringView filename, i32 num_threads) {
+    MappedFile file;
+    if (!map_file(&file, filename)) {
+        LOG_ERROR("Could not read file: '%.*s'.", filename.length(), filename.cstr());
+        return false;
+    }
+    defer { unmap_file(&file); };
+
+    return load_molecule_from_string(mol, file, num_threads);
+}
+
+bool load_molecule_from_string(MoleculeStructure* mol, CStringView cif_string, i32 num_threads) {
+    ASSERT(mol);
+
+    AtomSiteLoop loop;
+    if (!find_atom_site_loop(&loop, cif_string)) {
+        return false;
+    }
+    CStringView body = loop.body;
+
+    // The model of the first row is the one which is loaded
+    i32 first_model = 0;
+    {
+        const char* c = body.beg();
+        const CStringView row = next_row(c, body.end());
+        CStringView fields[NumFields] = {};
+        if (!row || is_loop_terminator(row) || tokenize_row(fields, loop, row) != loop.num_columns) {
+            LOG_ERROR("mmCIF _atom_site loop does not contain any valid rows");
+            return false;
+        }
+        first_model = extract_key(fields).model;
+    }
+
+    // Ensembles (e.g. NMR) hold many models of which only the first is loaded, so the rows of the other models are cut off before they are counted and allocated.
+    // @NOTE: Without a model column every row belongs to the same model and the loop is cut off by its terminator while counting
+    bool has_model_column = false;
+    for (i32 i = 0; i < loop.num_columns && i < MAX_COLUMNS; i++) {
+        if (loop.column_field[i] == ModelNum) has_model_column = true;
+    }
+    if (has_model_column) {
+        body = {body.beg(), find_model_end(loop, body, first_model)};
+    }
+
+    num_threads = get_num_threads(num_threads);
+    const i64 max_threads = (body.length() + MIN_CHUNK_SIZE - 1) / MIN_CHUNK_SIZE;
+    if (num_threads > max_threads) num_threads = (i32)max_threads;
+
+    DynamicArray<Chunk> chunks(num_threads, Chunk());
+    for (i32 t = 0; t < num_threads; t++) {
+        const char* c = body.beg() + body.length() * t / num_threads;
+        if (t > 0 && c[-1] != '\n') {
+            const char* nl = (const char*)memchr(c, '\n', body.end() - c);
+            c = nl ? nl + 1 : body.end();
+        }
+        chunks[t].beg = c;
+        if (t > 0) chunks[t - 1].end = c;
+    }
+    chunks.back().end = body.end();
+
+    // Pass 1: Count the rows of each chunk and find the end of the loop.
+    // Chunks which lie beyond the end of the loop are discarded, which wastes a little work but avoids a serial scan for the end.
+    run_on_threads(num_threads, [&chunks](i32 thread_idx) {
+        Chunk& chunk = chunks[thread_idx];
+        const char* c = chunk.beg;
+        CStringView row;
+        while ((row = next_row(c, chunk.end))) {
+            if (is_loop_terminator(row)) {
+                chunk.end = row.beg();
+                chunk.terminated = true;
+                break;
+            }
+            chunk.num_rows++;
+        }
+    });
+
+    i32 num_chunks = num_threads;
+    for (i32 t = 0; t < num_threads; t++) {
+        if (chunks[t].terminated) {
+            num_chunks = t + 1;
+            break;
+        }
+    }
+
+    i64 num_rows = 0;
+    for (i32 t = 0; t < num_chunks; t++) {
+        chunks[t].row_offset = num_rows;
+        num_rows += chunks[t].num_rows;
+    }
+
+    // Pass 2: Tokenize the rows and extract the atoms. Residue and chain boundaries are flagged by comparing each row to the previous one,
+    // the first row of a chunk is compared to the last row of the previous chunk, so every chunk agrees on where the boundaries are.
+    DynamicArray<AtomDescriptor> atoms(num_rows);
+    DynamicArray<u8> row_flags(num_rows);
+
+    run_on_threads(num_chunks, [&](i32 thread_idx) {
+        Chunk& chunk = chunks[thread_idx];
+        CStringView fields[NumFields] = {};
+
+        RowKey prev_key;
+        if (thread_idx > 0) {
+            const CStringView prev = prev_row(chunk.beg, body.beg());
+            tokenize_row(fields, loop, prev);
+            prev_key = extract_key(fields);
+        }
+
+        const char* c = chunk.beg;
+        i64 idx = chunk.row_offset;
+        CStringView row;
+        while ((row = next_row(c, chunk.end))) {
+            memset(fields, 0, sizeof(fields));
+            if (tokenize_row(fields, loop, row) != loop.num_columns) {
+                chunk.valid = false;
+                return;
+            }
+            const RowKey key = extract_key(fields);
+            if (key.model != first_model) {
+                // @NOTE: Models are stored one after another, so the first row of another model ends the first model
+                break;
+            }
+
+            const u8 flags = idx == 0 ? (NewChain | NewResidue) : compare_keys(prev_key, key);
+            if (flags & NewResidue) chunk.num_residues++;
+            if (flags & NewChain) chunk.num_chains++;
+            row_flags[idx] = flags;
+
+            AtomDescriptor& atom = atoms[idx];
+            atom.x = str_to_float(fields[CartnX]);
+            atom.y = str_to_float(fields[CartnY]);
+            atom.z = str_to_float(fields[CartnZ]);
+            atom.name = fields[AtomId];
+            atom.element = fields[TypeSymbol] ? get_element_from_string(fields[TypeSymbol], true) : Element::Unknown;
+            atom.residue_index = 0;
+
+            prev_key = key;
+            chunk.num_model_rows++;
+            idx++;
+        }
+    });
+
+    // The first model ends within the first chunk which holds fewer rows of it than rows in total
+    i64 num_atoms = 0;
+    i64 num_residues = 0;
+    i64 num_chains = 0;
+    for (i32 t = 0; t < num_chunks; t++) {
+        Chunk& chunk = chunks[t];
+        if (!chunk.valid) {
+            LOG_ERROR("mmCIF _atom_site loop contains a malformed row (rows spanning multiple lines are not supported)");
+            return false;
+        }
+        chunk.residue_offset = num_residues;
+        chunk.chain_offset = num_chains;
+        num_atoms += chunk.num_model_rows;
+        num_residues += chunk.num_residues;
+        num_chains += chunk.num_chains;
+        if (chunk.num_model_rows < chunk.num_rows) {
+            num_chunks = t + 1;
+            break;
+        }
+    }
+
+    // Pass 3: Fill the residues and chains from the flagged rows, only the rows which start a residue have to be tokenized again
+    DynamicArray<ResidueDescriptor> residues(num_residues);
+    DynamicArray<ChainDescriptor> chains(num_chains);
+
+    run_on_threads(num_chunks, [&](i32 thread_idx) {
+        const Chunk& chunk = chunks[thread_idx];
+        CStringView fields[NumFields] = {};
+
+        i64 res_idx = chunk.residue_offset - 1;
+        i64 chain_idx = chunk.chain_offset - 1;
+        const char* c = chunk.beg;
+        for (i64 i = 0; i < chunk.num_model_rows; i++) {
+            const CStringView row = next_row(c, chunk.end);
+            const i64 idx = chunk.row_offset + i;
+            const u8 flags = row_flags[idx];
+            if (flags & NewResidue) {
+                memset(fields, 0, sizeof(fields));
+                tokenize_row(fields, loop, row);
+                const RowKey key = extract_key(fields);
+
+                res_idx++;
+                ResidueDescriptor& res = residues[res_idx];
+                res.name = key.comp;
+                res.id = (ResIdx)key.seq_id;
+                res.atom_range = {(AtomIdx)idx, (AtomIdx)idx};
+
+                if (flags & NewChain) {
+                    chain_idx++;
+                    ChainDescriptor& chain = chains[chain_idx];
+                    chain.id = key.asym;
+                    chain.residue_range = {(ResIdx)res_idx, (ResIdx)res_idx};
+                }
+            }
+            atoms[idx].residue_index = (ResIdx)res_idx;
+        }
+    });
+
+    // A residue (chain) ends where the next one begins, regardless of which thread it was started by
+    for (i64 i = 0; i < num_residues - 1; i++) {
+        residues[i].atom_range.end = residues[i + 1].atom_range.beg;
+    }
+    if (num_residues > 0) residues.back().atom_range.end = (AtomIdx)num_atoms;
+
+    for (i64 i = 0; i < num_chains - 1; i++) {
+        chains[i].residue_range.end = chains[i + 1].residue_range.beg;
+    }
+    if (num_chains > 0) chains.back().residue_range.end = (ResIdx)num_residues;
+
+    // @NOTE: The fields still reference the string, they are interned into the string pool of the structure here
+    MoleculeStructureDescriptor desc;
+    desc.num_atoms = num_atoms;
+    desc.atoms = atoms.data();
+    desc.num_residues = num_residues;
+    desc.residues = residues.data();
+    desc.num_chains = num_chains;
+    desc.chains = chains.data();
+
+    return init_molecule_structure(mol, desc);
+}
+
+}  // namespace cif
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <core/types.h>
+#include <core/string_types.h>
+#include <mol/molecule_structure.h>
+
+namespace cif {
+
+// Loads the atoms of the first model within the _atom_site loop of an mmCIF (PDBx) file.
+// The rows of the loop are tokenized concurrently on num_threads threads (<= 0 uses all hardware threads).
+// Fields are referenced in place (no copies) until they are interned into the string pool of the structure.
+// @NOTE: Every row of the loop is expected to occupy a single line, which holds for all files distributed by the wwPDB.
+bool load_molecule_from_file(MoleculeStructure* mol, CStringView filename, i32 num_threads = 0);
+bool load_molecule_from_string(MoleculeStructure* mol, CStringView string, i32 num_threads = 0);
+
+}  // namespace cif
@@ -0,0 +1,388 @@
+#include "dcd_utils.h"
+#include <core/common.h>
+#include <core/log.h>
+#include <core/file.h>
+
+#include <string.h>
+#include <math.h>
+
+namespace dcd {
+
+// One AKMA time unit in picoseconds
+constexpr f64 AKMA_TIME_UNIT = 0.0488882129;
+
+// Size of the unit cell record: six doubles enclosed by the record markers
+constexpr u64 UNIT_CELL_RECORD_SIZE = 4 + 6 * sizeof(f64) + 4;
+
+inline u32 byte_swap(u32 v) { return (v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000) | (v << 24); }
+inline u64 byte_swap(u64 v) { return ((u64)byte_swap((u32)v) << 32) | byte_swap((u32)(v >> 32)); }
+
+inline i32 read_i32(const u8* data, bool swap) {
+    u32 v;
+    memcpy(&v, data, sizeof(v));
+    return (i32)(swap ? byte_swap(v) : v);
+}
+
+inline f64 read_f64(const u8* data, bool swap) {
+    u64 v;
+    memcpy(&v, data, sizeof(v));
+    if (swap) v = byte_swap(v);
+    f64 d;
+    memcpy(&d, &v, sizeof(d));
+    return d;
+}
+
+inline u64 coordinate_record_size(i32 num_atoms) { return 4 + (u64)num_atoms * sizeof(float) + 4; }
+
+// The unit cell is stored as (A, gamma, B, beta, alpha, C).
+// NAMD and recent versions of CHARMM store the cosines of the angles, older versions store the angles in degrees.
+static mat3 unit_cell_to_box(const f64 cell[6]) {
+    const f64 a = cell[0];
+    const f64 b = cell[2];
+    const f64 c = cell[5];
+    f64 cos_alpha = cell[4];
+    f64 cos_beta = cell[3];
+    f64 cos_gamma = cell[1];
+    if (fabs(cos_alpha) > 1.0 || fabs(cos_beta) > 1.0 || fabs(cos_gamma) > 1.0) {
+        constexpr f64 deg_to_rad = 3.14159265358979323846 / 180.0;
+        cos_alpha = cos(cos_alpha * deg_to_rad);
+        cos_beta = cos(cos_beta * deg_to_rad);
+        cos_gamma = cos(cos_gamma * deg_to_rad);
+    }
+
+    mat3 box(0);
+    const f64 sin_gamma = sqrt(1.0 - cos_gamma * cos_gamma);
+    if (a <= 0 || sin_gamma <= 0) return box;
+
+    const f64 cx = c * cos_beta;
+    const f64 cy = c * (cos_alpha - cos_beta * cos_gamma) / sin_gamma;
+    const f64 cz2 = c * c - cx * cx - cy * cy;
+    box[0][0] = (float)a;
+    box[1][0] = (float)(b * cos_gamma);
+    box[1][1] = (float)(b * sin_gamma);
+    box[2][0] = (float)cx;
+    box[2][1] = (float)cy;
+    box[2][2] = (float)(cz2 > 0 ? sqrt(cz2) : 0);
+    return box;
+}
+
+static void box_to_unit_cell(f64 cell[6], const mat3& box) {
+    const auto dot = [&box](int i, int j) -> f64 { return (f64)box[i][0] * box[j][0] + (f64)box[i][1] * box[j][1] + (f64)box[i][2] * box[j][2]; };
+    const f64 a = sqrt(dot(0, 0));
+    const f64 b = sqrt(dot(1, 1));
+    const f64 c = sqrt(dot(2, 2));
+    cell[0] = a;
+    cell[1] = (a > 0 && b > 0) ? dot(0, 1) / (a * b) : 0;  // cos(gamma)
+    cell[2] = b;
+    cell[3] = (a > 0 && c > 0) ? dot(0, 2) / (a * c) : 0;  // cos(beta)
+    cell[4] = (b > 0 && c > 0) ? dot(1, 2) / (b * c) : 0;  // cos(alpha)
+    cell[5] = c;
+}
+
+static bool parse_header(Header* header, const u8* data, i64 size) {
+    ASSERT(header);
+    if (size < 92) {
+        LOG_ERROR("File is too small to be a dcd");
+        return false;
+    }
+
+    // The first record holds 84 bytes, which also reveals the byte order of the file
+    bool swap = false;
+    const u32 marker = (u32)read_i32(data, false);
+    if (marker != 84) {
+        if (byte_swap(marker) != 84) {
+            LOG_ERROR("Unrecognized dcd header (dcd files with 64-bit record markers are not supported)");
+            return false;
+        }
+        swap = true;
+    }
+    if (memcmp(data + 4, "CORD", 4) != 0 || read_i32(data + 88, swap) != 84) {
+        LOG_ERROR("Unrecognized dcd header");
+        return false;
+    }
+
+    i32 icntrl[20];
+    for (i32 i = 0; i < 20; i++) icntrl[i] = read_i32(data + 8 + i * 4, swap);
+    const bool charmm = icntrl[19] != 0;
+    const i32 num_fixed_atoms = icntrl[8];
+
+    Header h;
+    h.first_step = icntrl[1];
+    h.step_interval = icntrl[2];
+    if (charmm) {
+        u32 bits = (u32)icntrl[9];
+        memcpy(&h.timestep, &bits, sizeof(h.timestep));
+    } else {
+        // X-PLOR stores the timestep as a double spanning two entries
+        h.timestep = (f32)read_f64(data + 8 + 9 * 4, swap);
+    }
+    h.has_unit_cell = charmm && icntrl[10] != 0;
+    h.has_4d = charmm && icntrl[11] != 0;
+    h.swap_endian = swap;
+
+    // Title record: number of 80 character lines followed by the lines
+    i64 p = 92;
+    if (p + 4 > size) return false;
+    const i32 title_size = read_i32(data + p, swap);
+    if (title_size < 4 || p + 8 + title_size + 12 > size || read_i32(data + p + 4 + title_size, swap) != title_size) {
+        LOG_ERROR("Corrupt dcd title record");
+        return false;
+    }
+    p += 8 + title_size;
+
+    // Atom count record
+    if (read_i32(data + p, swap) != 4 || read_i32(data + p + 8, swap) != 4) {
+        LOG_ERROR("Corrupt dcd atom count record");
+        return false;
+    }
+    h.num_atoms = read_i32(data + p + 4, swap);
+    p += 12;
+
+    if (h.num_atoms <= 0) {
+        LOG_ERROR("Dcd does not contain any atoms");
+        return false;
+    }
+    if (num_fixed_atoms > 0) {
+        // @NOTE: Only the free atoms are stored after the first frame, which would break the fixed frame size
+        LOG_ERROR("Dcd files with fixed atoms are not supported");
+        return false;
+    }
+
+    h.frame_offset = (u64)p;
+    h.frame_extent = (h.has_unit_cell ? UNIT_CELL_RECORD_SIZE : 0) + (h.has_4d ? 4 : 3) * coordinate_record_size(h.num_atoms);
+    h.num_frames = (i32)(((u64)size - h.frame_offset) / h.frame_extent);
+    if (h.num_frames != icntrl[0]) {
+        LOG_NOTE("Dcd header states %i frames, but the file holds %i", icntrl[0], h.num_frames);
+    }
+
+    *header = h;
+    return true;
+}
+
+// Time of a frame in picoseconds, frames without a valid timestep are spaced one time unit apart
+inline f32 frame_time(const Header& h, i32 frame_index) {
+    if (h.timestep == 0 || h.step_interval == 0) return (f32)frame_index;
+    return (f32)(((f64)h.first_step + (f64)frame_index * h.step_interval) * h.timestep * AKMA_TIME_UNIT);
+}
+
+// Validates the records of a frame and returns the pointers to its coordinate planes and its box.
+// @NOTE: Whether the frame starts with a unit cell record has to come from the header, its marker (48) equals the one of a coordinate plane of 12 atoms.
+static bool locate_frame_planes(const float* plane[3], mat3* box, i32 num_atoms, const u8* data, i64 size, bool swap, bool has_unit_cell) {
+    i64 p = 0;
+    if (has_unit_cell) {
+        if (size < (i64)UNIT_CELL_RECORD_SIZE || read_i32(data, swap) != 48 || read_i32(data + 52, swap) != 48) return false;
+        f64 cell[6];
+        for (i32 i = 0; i < 6; i++) cell[i] = read_f64(data + 4 + i * sizeof(f64), swap);
+        *box = unit_cell_to_box(cell);
+        p += UNIT_CELL_RECORD_SIZE;
+    }
+
+    const i32 plane_size = num_atoms * (i32)sizeof(float);
+    for (i32 i = 0; i < 3; i++) {
+        if (p + (i64)coordinate_record_size(num_atoms) > size) return false;
+        if (read_i32(data + p, swap) != plane_size || read_i32(data + p + 4 + plane_size, swap) != plane_size) return false;
+        plane[i] = (const float*)(data + p + 4);
+        p += coordinate_record_size(num_atoms);
+    }
+    return true;
+}
+
+static bool extract_frame_data(TrajectoryFrame* frame, i32 num_atoms, const u8* data, i64 size, bool swap, bool has_unit_cell) {
+    const float* plane[3];
+    if (!locate_frame_planes(plane, &frame->box, num_atoms, data, size, swap, has_unit_cell)) return false;
+
+    float* dst[3] = {frame->atom_position.x, frame->atom_position.y, frame->atom_position.z};
+    for (i32 i = 0; i < 3; i++) {
+        memcpy(dst[i], plane[i], num_atoms * sizeof(float));
+        if (swap) {
+            u32* v = (u32*)dst[i];
+            for (i32 j = 0; j < num_atoms; j++) v[j] = byte_swap(v[j]);
+        }
+    }
+    return true;
+}
+
+bool read_header(Header* header, CStringView filename) {
+    MappedFile mapped;
+    if (!map_file(&mapped, filename, MapAccess::Random)) {
+        LOG_ERROR("Could not open file '%.*s'", (int)filename.length(), filename.beg());
+        return false;
+    }
+    defer { unmap_file(&mapped); };
+    return parse_header(header, (const u8*)mapped.data, mapped.size);
+}
+
+bool load_trajectory_from_file(MoleculeTrajectory* traj, CStringView filename, bool zero_copy) {
+    ASSERT(traj);
+
+    MappedFile mapped;
+    if (!map_file(&mapped, filename, MapAccess::Sequential, true)) {
+        LOG_ERROR("Could not open file '%.*s'", (int)filename.length(), filename.beg());
+        return false;
+    }
+
+    Header header;
+    if (!parse_header(&header, (const u8*)mapped.data, mapped.size) || header.num_frames == 0) {
+        unmap_file(&mapped);
+        return false;
+    }
+    const i32 num_atoms = header.num_atoms;
+    const i32 num_frames = header.num_frames;
+    const u8* frame_data = (const u8*)mapped.data + header.frame_offset;
+    const f32 dt = num_frames > 1 ? frame_time(header, 1) - frame_time(header, 0) : 1.0f;
+
+    // Planes of the wrong byte order have to be swapped, which rules out pointing at them
+    if (header.swap_endian) zero_copy = false;
+
+    if (!zero_copy) {
+        defer { unmap_file(&mapped); };
+        if (!init_trajectory(traj, num_atoms, num_frames, dt)) {
+            return false;
+        }
+        for (i32 i = 0; i < num_frames; i++) {
+            TrajectoryFrame& frame = traj->frame_buffer[i];
+            if (!extract_frame_data(&frame, num_atoms, frame_data + i * header.frame_extent, header.frame_extent, header.swap_endian, header.has_unit_cell)) {
+                LOG_ERROR("Dcd frame %i is corrupt", i);
+                free_trajectory(traj);
+                return false;
+            }
+            frame.time = frame_time(header, i);
+        }
+        traj->total_simulation_time = frame_time(header, num_frames - 1) - frame_time(header, 0);
+        return true;
+    }
+
+    TrajectoryFrame* frame_mem = (TrajectoryFrame*)MALLOC(num_frames * sizeof(TrajectoryFrame));
+    if (!frame_mem) {
+        LOG_ERROR("Could not allocate memory for trajectory frames");
+        unmap_file(&mapped);
+        return false;
+    }
+
+    for (i32 i = 0; i < num_frames; i++) {
+        TrajectoryFrame& frame = frame_mem[i];
+        const float* plane[3];
+        frame = {};
+        if (!locate_frame_planes(plane, &frame.box, num_atoms, frame_data + i * header.frame_extent, header.frame_extent, false, header.has_unit_cell)) {
+            LOG_ERROR("Dcd frame %i is corrupt", i);
+            FREE(frame_mem);
+            unmap_file(&mapped);
+            return false;
+        }
+        // @NOTE: The mapping is copy-on-write, so it is fine to hand out mutable pointers
+        frame.index = i;
+        frame.time = frame_time(header, i);
+        frame.atom_position = {(float*)plane[0], (float*)plane[1], (float*)plane[2]};
+    }
+
+    free_trajectory(traj);
+    traj->num_atoms = num_atoms;
+    traj->num_frames = num_frames;
+    traj->total_simulation_time = frame_time(header, num_frames - 1) - frame_time(header, 0);
+    traj->frame_buffer = {frame_mem, num_frames};
+    // The planes of consecutive frames are separated by record markers, so there is no contiguous position data
+    traj->position_data = {};
+    traj->mapped_file = mapped;
+
+    return true;
+}
+
+static bool write_record(FILE* file, const void* data, u32 size) {
+    return fwrite(&size, sizeof(size), 1, file) == 1 && (size == 0 || fwrite(data, 1, size, file) == size) && fwrite(&size, sizeof(size), 1, file) == 1;
+}
+
+bool write_trajectory(MoleculeTrajectory& traj, CStringView filename) {
+    const i32 num_atoms = traj.num_atoms;
+    const i32 num_frames = traj.num_frames;
+    if (num_atoms <= 0) {
+        LOG_ERROR("Trajectory does not contain any atoms");
+        return false;
+    }
+
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        LOG_ERROR("Could not open file '%.*s'", (int)filename.length(), filename.beg());
+        return false;
+    }
+    defer { fclose(file); };
+
+    const f32 t0 = num_frames > 0 ? get_trajectory_frame(traj, 0).time : 0.0f;
+    f32 dt = num_frames > 1 ? get_trajectory_frame(traj, 1).time - t0 : 1.0f;
+    if (dt <= 0) dt = 1.0f;
+
+    // CHARMM flavour: the timestep is a float and the frames carry a unit cell
+    struct {
+        char cord[4] = {'C', 'O', 'R', 'D'};
+        i32 icntrl[20] = {};
+    } header_record;
+    const f32 timestep = (f32)(dt / AKMA_TIME_UNIT);
+    header_record.icntrl[0] = num_frames;
+    header_record.icntrl[1] = (i32)lround(t0 / dt);
+    header_record.icntrl[2] = 1;
+    header_record.icntrl[3] = num_frames;
+    memcpy(&header_record.icntrl[9], &timestep, sizeof(timestep));
+    header_record.icntrl[10] = 1;
+    header_record.icntrl[19] = 24;
+
+    struct {
+        i32 num_lines = 1;
+        char line[80];
+    } title_record;
+    memset(title_record.line, ' ', sizeof(title_record.line));
+    constexpr CStringView title = "REMARKS Written by mdutils";
+    memcpy(title_record.line, title.beg(), title.length());
+
+    bool ok = write_record(file, &header_record, sizeof(header_record)) && write_record(file, &title_record, sizeof(title_record)) &&
+              write_record(file, &num_atoms, sizeof(num_atoms));
+
+    const u32 plane_size = (u32)num_atoms * sizeof(float);
+    for (i32 i = 0; i < num_frames && ok; i++) {
+        const TrajectoryFrame& frame = get_trajectory_frame(traj, i);
+        f64 cell[6];
+        box_to_unit_cell(cell, frame.box);
+        ok = write_record(file, cell, sizeof(cell)) && write_record(file, frame.atom_position.x, plane_size) &&
+             write_record(file, frame.atom_position.y, plane_size) && write_record(file, frame.atom_position.z, plane_size);
+    }
+
+    if (!ok) {
+        LOG_ERROR("Could not write dcd '%.*s'", (int)filename.length(), filename.beg());
+    }
+    return ok;
+}
+
+bool read_trajectory_num_frames(i32* num_frames, CStringView filename) {
+    ASSERT(num_frames);
+    Header header;
+    if (!read_header(&header, filename)) return false;
+    *num_frames = header.num_frames;
+    return true;
+}
+
+bool read_trajectory_frame_bytes(FrameBytes* frame_bytes, CStringView filename) {
+    ASSERT(frame_bytes);
+    Header header;
+    if (!read_header(&header, filename)) return false;
+    for (i32 i = 0; i < header.num_frames; i++) {
+        frame_bytes[i] = {header.frame_offset + i * header.frame_extent, header.frame_extent};
+    }
+    return true;
+}
+
+bool extract_trajectory_frame(TrajectoryFrame* frame, i32 num_atoms, Array<u8> raw_data) {
+    ASSERT(frame);
+    if (raw_data.size() < 4) return false;
+
+    // The frame bytes only cover a unit cell record in addition to the coordinate planes if the header states one.
+    // @NOTE: With 12 atoms a 4D frame without a unit cell has the same size, such frames are read as 3D frames with a unit cell.
+    const u64 planes_size = 3 * coordinate_record_size(num_atoms);
+    const u64 size = (u64)raw_data.size();
+    const bool has_unit_cell = size == UNIT_CELL_RECORD_SIZE + planes_size || size == UNIT_CELL_RECORD_SIZE + planes_size + coordinate_record_size(num_atoms);
+
+    // The first record marker then has a known value, which reveals the byte order
+    const u32 marker = (u32)read_i32(raw_data.data(), false);
+    const u32 expected = has_unit_cell ? 48 : (u32)num_atoms * sizeof(float);
+    const bool swap = marker != expected;
+    return extract_frame_data(frame, num_atoms, raw_data.data(), raw_data.size(), swap, has_unit_cell);
+}
+
+}  // namespace dcd
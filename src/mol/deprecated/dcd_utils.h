@@ -0,0 +1,45 @@
+#pragma once
+
+#include <mol/molecule_trajectory.h>
+#include <mol/trajectory_utils.h>
+
+// CHARMM / NAMD binary trajectories (dcd).
+// Every frame stores the coordinates as three raw float planes (x, y, z), which is the same layout as soa_vec3, so frames require no decoding.
+
+namespace dcd {
+
+struct Header {
+    i32 num_atoms = 0;
+    i32 num_frames = 0;       // Derived from the file size, the frame count of the header is not reliable for files which are still being written
+    i32 first_step = 0;       // ISTART
+    i32 step_interval = 0;    // NSAVC, number of integration steps between frames
+    f32 timestep = 0;         // DELTA, in AKMA time units
+    bool has_unit_cell = false;
+    bool has_4d = false;      // Frames hold a fourth coordinate plane, which is skipped
+    bool swap_endian = false; // The file was written on a machine with a different byte order
+    u64 frame_offset = 0;     // Byte offset of the first frame
+    u64 frame_extent = 0;     // Bytes per frame
+};
+
+bool read_header(Header* header, CStringView filename);
+
+// Memory maps the file and points the position data of each frame straight at its coordinate planes within the mapping, no data is copied.
+// The mapping is copy-on-write, so the positions can be modified without touching the file on disk.
+// With zero_copy disabled (or if the byte order of the file differs) the planes are copied into memory owned by the trajectory, one memcpy per plane.
+// @NOTE: The planes within the mapping are only 4-byte aligned.
+bool load_trajectory_from_file(MoleculeTrajectory* traj, CStringView filename, bool zero_copy = true);
+
+// Writes all frames of the trajectory in CHARMM format with a unit cell, in native byte order.
+// The frames are expected to be equally spaced in time. Streamed trajectories are fetched frame by frame.
+bool write_trajectory(MoleculeTrajectory& traj, CStringView filename);
+
+// --- Core Trajectory Functionality ---
+bool read_trajectory_num_frames(i32* num_frames, CStringView filename);
+
+// Frames have a fixed size, so the byte ranges follow from the header (num_frames entries)
+bool read_trajectory_frame_bytes(FrameBytes* frame_bytes, CStringView filename);
+
+// Extracts a frame from its raw bytes (unit cell record followed by the coordinate records), matches ExtractFrameFunc
+bool extract_trajectory_frame(TrajectoryFrame* frame, i32 num_atoms, Array<u8> raw_data);
+
+}  // namespace dcd
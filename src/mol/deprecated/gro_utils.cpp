@@ -1,7 +1,9 @@
 #include "gro_utils.h"
 #include <core/string_utils.h>
 #include <core/log.h>
+#include <core/file.h>
 #include <mol/molecule_utils.h>
+#include <core/sync.h>
 
 #include <stdio.h>
 
@@ -11,16 +13,6 @@ struct LineFormat {
     int pos_width = 0;
 };
 
-bool load_molecule_from_file(MoleculeStructure* mol, CStringView filename) {
-    StringView txt = allocate_and_read_textfile(filename);
-    defer { FREE(txt.cstr()); };
-    if (!txt) {
-        LOG_ERROR("Could not read file: '%.*s'.", filename.length(), filename);
-        return false;
-    }
-    return load_molecule_from_string(mol, txt);
-}
-
 inline LineFormat get_format(CStringView line) {
     LineFormat format = {0};
 
@@ -36,25 +28,115 @@ inline LineFormat get_format(CStringView line) {
     return format;
 }
 
-inline void extract_position_data(float* x, float* y, float* z, CStringView line, int width) {
-    *x = str_to_float(line.substr(20 + 0 * width, width)) * 10.0f; // nm -> Å
-    *y = str_to_float(line.substr(20 + 1 * width, width)) * 10.0f;
-    *z = str_to_float(line.substr(20 + 2 * width, width)) * 10.0f;
+// Parses the coordinate columns of a batch of atom records
+inline void extract_position_data(float* x, float* y, float* z, const CStringView* lines, i64 count, int width) {
+    parse_fixed_width_floats(x, lines, count, 20 + 0 * width, width, 10.0f); // nm -> Å
+    parse_fixed_width_floats(y, lines, count, 20 + 1 * width, width, 10.0f);
+    parse_fixed_width_floats(z, lines, count, 20 + 2 * width, width, 10.0f);
+}
+
+// Box line: v1(x) v2(y) v3(z) [v1(y) v1(z) v2(x) v2(z) v3(x) v3(y)], the off-diagonal elements are only present for triclinic boxes
+inline void extract_box(mat3* box, CStringView line) {
+    float v[9] = {};
+    i32 count = 0;
+    const char* c = line.beg();
+    while (count < 9) {
+        while (c != line.end() && is_whitespace(*c)) c++;
+        if (c == line.end()) break;
+        const char* token_beg = c;
+        while (c != line.end() && !is_whitespace(*c)) c++;
+        v[count++] = str_to_float({token_beg, c});
+    }
+
+    *box = mat3(0);
+    (*box)[0][0] = v[0];
+    (*box)[1][1] = v[1];
+    (*box)[2][2] = v[2];
+    (*box)[0][1] = v[3];
+    (*box)[0][2] = v[4];
+    (*box)[1][0] = v[5];
+    (*box)[1][2] = v[6];
+    (*box)[2][0] = v[7];
+    (*box)[2][1] = v[8];
+    *box *= 10.0f;  // nm -> Å
+}
+
+// Titles written by gromacs tools carry the time of the frame, e.g. "Protein in water t=  10.00000 step= 5000"
+inline bool extract_time(float* time, CStringView title) {
+    CStringView t = find_pattern_in_string(title, "t=");
+    if (!t) return false;
+    const char* c = t.end();
+    while (c != title.end() && *c == ' ') c++;
+    const char* num_beg = c;
+    while (c != title.end() && !is_whitespace(*c)) c++;
+    if (c == num_beg) return false;
+    *time = str_to_float({num_beg, c});
+    return true;
 }
 
-inline void extract_box_ext_data(float* x, float* y, float* z, CStringView line) {
-    *x = str_to_float(line.substr(0, 8));
-    *y = str_to_float(line.substr(10, 8));
-    *z = str_to_float(line.substr(20, 8));
+// Atom records of a frame.
+// Gro records are written with a fixed format, so every record has the same width and record i starts at a computable offset.
+// This allows the records to be split between threads (and frames to be indexed) without scanning for line breaks.
+struct AtomRecords {
+    const char* beg = nullptr;
+    i64 stride = 0;                      // Bytes per record including the line break, 0 if the records vary in width
+    i64 length = 0;                      // Bytes per record excluding the line break
+    const CStringView* lines = nullptr;  // Only used if stride is 0
+
+    CStringView operator[](i64 i) const { return stride ? CStringView(beg + i * stride, length) : lines[i]; }
+};
+
+// Derives the record width from the first record, str is expected to start at the first record.
+// @NOTE: Only the line break of the last record is checked here, the remaining records are validated by the parser.
+static bool get_fixed_width_records(AtomRecords* rec, CStringView str, i64 num_atoms) {
+    const char* nl = find_character(str, '\n');
+    if (!nl) return false;
+    const i64 stride = nl - str.beg() + 1;
+    const i64 size = num_atoms * stride;
+    if (size > str.length() || str[size - 1] != '\n') return false;
+
+    rec->beg = str.beg();
+    rec->stride = stride;
+    rec->length = (stride > 1 && nl[-1] == '\r') ? stride - 2 : stride - 1;
+    rec->lines = nullptr;
+    return true;
+}
+
+// Fallback for records of varying width, the lines are split sequentially
+static bool split_records(AtomRecords* rec, DynamicArray<CStringView>* lines, CStringView str, i64 num_atoms) {
+    lines->resize(num_atoms);
+    if (extract_lines(lines->data(), num_atoms, str) != num_atoms) return false;
+    rec->beg = str.beg();
+    rec->stride = 0;
+    rec->length = 0;
+    rec->lines = lines->data();
+    return true;
+}
+
+inline int extract_residue_id(CStringView record) { return to_int(record.substr(0, 5)); }
+
+// Records per thread below which it is not worth spawning another thread
+constexpr i64 MIN_RECORDS_PER_THREAD = 4096;
+constexpr i64 RECORD_BATCH_SIZE = 256;
+
+bool load_molecule_from_file(MoleculeStructure* mol, CStringView filename, i32 num_threads) {
+    MappedFile file;
+    if (!map_file(&file, filename)) {
+        LOG_ERROR("Could not read file: '%.*s'.", filename.length(), filename.cstr());
+        return false;
+    }
+    defer { unmap_file(&file); };
+
+    return load_molecule_from_string(mol, file, num_threads);
 }
 
-bool load_molecule_from_string(MoleculeStructure* mol, CStringView gro_string) {
+bool load_molecule_from_string(MoleculeStructure* mol, CStringView gro_string, i32 num_threads) {
     CStringView header = extract_line(gro_string);
     CStringView length = extract_line(gro_string);
     (void)header;
 
-    int num_atoms = to_int(length);
-    if (num_atoms == 0) {
+    const i64 num_atoms = to_int(length);
+    if (num_atoms <= 0) {
         return false;
     }
 
@@ -64,33 +146,124 @@ bool load_molecule_from_string(MoleculeStructure* mol, CStringView gro_string) {
         return false;
     }
 
-    DynamicArray<AtomDescriptor> atoms;
-    DynamicArray<ResidueDescriptor> residues;
-    atoms.reserve(num_atoms);
-
-    int cur_res = -1;
-    CStringView line;
-
-    for (int i = 0; i < num_atoms; ++i) {
-        line = extract_line(gro_string);
-        
-        AtomDescriptor& atom = atoms.allocate_back();
-        extract_position_data(&atom.x, &atom.y, &atom.z, line, format.pos_width);
-        atom.name = trim(line.substr(10, 5));
-        
-        int res_id = to_int(line.substr(0, 5));
-        if (cur_res != res_id) { 
-            ResidueDescriptor& res = residues.allocate_back();
-            res.name = trim(line.substr(5, 5));
-            res.id = res_id;
-            res.atom_range = {i, i};
-            cur_res = res_id;
+    num_threads = get_num_threads(num_threads);
+    const i64 max_threads = (num_atoms + MIN_RECORDS_PER_THREAD - 1) / MIN_RECORDS_PER_THREAD;
+    if (num_threads > max_threads) num_threads = (i32)max_threads;
+
+    // @NOTE: Ranges start on batch boundaries, so the coordinates are parsed in exactly the same batches regardless of the number of threads.
+    // The SIMD and scalar paths of parse_fixed_width_floats may round differently, and the result should not depend on the thread count.
+    const auto thread_range = [num_atoms, num_threads](i32 thread_idx) -> Range<i64> {
+        const auto boundary = [num_atoms, num_threads](i32 t) -> i64 {
+            return t == num_threads ? num_atoms : (num_atoms * t / num_threads) & ~(RECORD_BATCH_SIZE - 1);
+        };
+        return {boundary(thread_idx), boundary(thread_idx + 1)};
+    };
+
+    AtomRecords rec;
+    DynamicArray<CStringView> lines;
+    const bool fixed_width = get_fixed_width_records(&rec, gro_string, num_atoms);
+    if (!fixed_width && !split_records(&rec, &lines, gro_string, num_atoms)) {
+        LOG_ERROR("Gro file contains fewer atoms than expected");
+        return false;
+    }
+
+    // Pass 1: Count the residues within each range, -1 if the range holds a record which breaks the fixed width.
+    // A residue starts wherever the residue id differs from the previous record, which may lie in the range of the previous thread.
+    // Looking across the seam makes every range agree on where the residues start, so no residue is counted twice.
+    DynamicArray<i64> residue_count(num_threads, 0);
+    const auto count_residues = [&](i32 thread_idx) {
+        const Range<i64> range = thread_range(thread_idx);
+        if (rec.stride) {
+            for (i64 i = range.beg; i < range.end; i++) {
+                if (rec.beg[(i + 1) * rec.stride - 1] != '\n') {
+                    residue_count[thread_idx] = -1;
+                    return;
+                }
+            }
+        }
+        i64 count = 0;
+        int prev_res_id = range.beg > 0 ? extract_residue_id(rec[range.beg - 1]) : 0;
+        for (i64 i = range.beg; i < range.end; i++) {
+            const int res_id = extract_residue_id(rec[i]);
+            if (i == 0 || res_id != prev_res_id) count++;
+            prev_res_id = res_id;
+        }
+        residue_count[thread_idx] = count;
+    };
+
+    run_on_threads(num_threads, count_residues);
+    if (fixed_width) {
+        for (i32 t = 0; t < num_threads; t++) {
+            if (residue_count[t] == -1) {
+                if (!split_records(&rec, &lines, gro_string, num_atoms)) {
+                    LOG_ERROR("Gro file contains fewer atoms than expected");
+                    return false;
+                }
+                run_on_threads(num_threads, count_residues);
+                break;
+            }
+        }
+    }
+
+    // Exclusive prefix sum gives the index of the first residue which starts within each range
+    DynamicArray<i64> residue_offset(num_threads);
+    i64 num_residues = 0;
+    for (i32 t = 0; t < num_threads; t++) {
+        residue_offset[t] = num_residues;
+        num_residues += residue_count[t];
+    }
+
+    // Pass 2: Parse positions, names and residues into the disjoint descriptor ranges of each thread
+    DynamicArray<AtomDescriptor> atoms(num_atoms);
+    DynamicArray<ResidueDescriptor> residues(num_residues);
+
+    run_on_threads(num_threads, [&](i32 thread_idx) {
+        // Every record is an atom record, so their coordinates are parsed in batches
+        constexpr i64 batch_size = RECORD_BATCH_SIZE;
+        CStringView batch[batch_size];
+        float x[batch_size];
+        float y[batch_size];
+        float z[batch_size];
+
+        const Range<i64> range = thread_range(thread_idx);
+        i64 res_idx = residue_offset[thread_idx] - 1;
+        int prev_res_id = range.beg > 0 ? extract_residue_id(rec[range.beg - 1]) : 0;
+
+        for (i64 i = range.beg; i < range.end; i += batch_size) {
+            const i64 count = range.end - i < batch_size ? range.end - i : batch_size;
+            for (i64 j = 0; j < count; j++) batch[j] = rec[i + j];
+            extract_position_data(x, y, z, batch, count, format.pos_width);
+
+            for (i64 j = 0; j < count; j++) {
+                const CStringView line = batch[j];
+                const int res_id = extract_residue_id(line);
+                if (i + j == 0 || res_id != prev_res_id) {
+                    res_idx++;
+                    ResidueDescriptor& res = residues[res_idx];
+                    res.name = trim(line.substr(5, 5));
+                    res.id = res_id;
+                    res.atom_range = {(AtomIdx)(i + j), (AtomIdx)(i + j)};
+                    prev_res_id = res_id;
+                }
+
+                AtomDescriptor& atom = atoms[i + j];
+                atom.x = x[j];
+                atom.y = y[j];
+                atom.z = z[j];
+                atom.name = trim(line.substr(10, 5));
+                atom.element = Element::Unknown;
+                atom.residue_index = (ResIdx)res_idx;
+            }
         }
+    });
 
-        atoms.back().residue_index = (ResIdx)residues.size() - 1;
-        residues.back().atom_range.end++;
+    // A residue ends where the next one begins, regardless of which thread it was started by
+    for (i64 i = 0; i < num_residues - 1; i++) {
+        residues[i].atom_range.end = residues[i + 1].atom_range.beg;
     }
+    if (num_residues > 0) residues.back().atom_range.end = (AtomIdx)num_atoms;
 
+    // @NOTE: The names are interned into the string pool of the structure, which is not thread safe, so this part remains serial
     MoleculeStructureDescriptor desc;
     desc.num_atoms = atoms.size();
     desc.atoms = atoms.data();
@@ -100,4 +273,178 @@ bool load_molecule_from_string(MoleculeStructure* mol, CStringView gro_string) {
     return init_molecule_structure(mol, desc);
 }
 
+// Parses a single frame: title, atom count, atom records and box
+static bool extract_frame_data(TrajectoryFrame* frame, i32 num_atoms, CStringView str) {
+    ASSERT(frame);
+    const CStringView title = extract_line(str);
+    const CStringView length = extract_line(str);
+    if (to_int(length) != num_atoms) return false;
+
+    const LineFormat format = get_format(peek_line(str));
+    if (format.pos_width == 0) return false;
+
+    // Frames without a time stamp in their title keep the time they were initialized with
+    extract_time(&frame->time, title);
+
+    constexpr i64 batch_size = 256;
+    CStringView lines[batch_size];
+    for (i64 i = 0; i < num_atoms;) {
+        const i64 remaining = num_atoms - i;
+        const i64 count = extract_lines(lines, remaining < batch_size ? remaining : batch_size, str);
+        if (count == 0) return false;
+        extract_position_data(frame->atom_position.x + i, frame->atom_position.y + i, frame->atom_position.z + i, lines, count, format.pos_width);
+        i += count;
+    }
+
+    const CStringView box = extract_line(str);
+    if (!box) return false;
+    extract_box(&frame->box, box);
+    return true;
+}
+
+// Every frame of a multi-frame gro is a complete gro record. The atom records of a frame are skipped with a single jump when their width is fixed,
+// so only the title, count and box lines of each frame are actually read.
+static bool index_frames(DynamicArray<FrameBytes>* frame_bytes, i32* num_atoms, CStringView str) {
+    const char* base = str.beg();
+    i64 frame_atoms = -1;
+    while (trim(str)) {
+        const char* frame_beg = str.beg();
+        extract_line(str);
+        const i64 count = to_int(extract_line(str));
+        if (count <= 0 || (frame_atoms != -1 && count != frame_atoms)) {
+            LOG_ERROR("Gro frame %i does not contain the expected number of atoms", (i32)frame_bytes->size());
+            return false;
+        }
+        frame_atoms = count;
+
+        AtomRecords rec;
+        if (get_fixed_width_records(&rec, str, count)) {
+            str = {rec.beg + count * rec.stride, str.end()};
+        } else {
+            for (i64 i = 0; i < count; i++) {
+                if (!extract_line(str)) {
+                    LOG_ERROR("Gro frame %i is truncated", (i32)frame_bytes->size());
+                    return false;
+                }
+            }
+        }
+        if (!extract_line(str)) {
+            LOG_ERROR("Gro frame %i is missing its box", (i32)frame_bytes->size());
+            return false;
+        }
+        frame_bytes->push_back({(u64)(frame_beg - base), (u64)(str.beg() - frame_beg)});
+    }
+
+    if (num_atoms) *num_atoms = (i32)frame_atoms;
+    return frame_bytes->size() > 0;
+}
+
+bool load_trajectory_from_file(MoleculeTrajectory* traj, CStringView filename, i32 num_threads) {
+    MappedFile file;
+    if (!map_file(&file, filename)) {
+        LOG_ERROR("Could not read file: '%.*s'.", filename.length(), filename.cstr());
+        return false;
+    }
+    defer { unmap_file(&file); };
+
+    return load_trajectory_from_string(traj, file, num_threads);
+}
+
+bool load_trajectory_from_string(MoleculeTrajectory* traj, CStringView gro_string, i32 num_threads) {
+    ASSERT(traj);
+    free_trajectory(traj);
+
+    DynamicArray<FrameBytes> frame_bytes;
+    i32 num_atoms = 0;
+    if (!index_frames(&frame_bytes, &num_atoms, gro_string)) {
+        LOG_ERROR("Could not index gro trajectory");
+        return false;
+    }
+    const i32 num_frames = (i32)frame_bytes.size();
+    const auto get_frame_str = [&frame_bytes, &gro_string](i64 i) -> CStringView {
+        return {gro_string.beg() + frame_bytes[i].offset, (i64)frame_bytes[i].extent};
+    };
+
+    // The simulation box and the time between frames are taken from the first frames
+    mat3 sim_box(0);
+    float t0 = 0.0f;
+    float t1 = 1.0f;
+    {
+        CStringView str = get_frame_str(0);
+        const bool has_time = extract_time(&t0, extract_line(str));
+        if (!has_time || num_frames < 2 || !extract_time(&t1, peek_line(get_frame_str(1)))) t1 = t0 + 1.0f;
+        CStringView last_line;
+        CStringView line;
+        while ((line = extract_line(str))) last_line = line;
+        extract_box(&sim_box, last_line);
+    }
+    const float dt = t1 - t0;
+
+    if (!init_trajectory(traj, num_atoms, num_frames, dt, sim_box)) {
+        return false;
+    }
+
+    num_threads = get_num_threads(num_threads);
+    if (num_threads > num_frames) num_threads = num_frames;
+
+    // Frames are extracted into the disjoint position data of their own frame, so frames are distributed over the threads
+    atomic_int32_t next_frame = 0;
+    atomic_int32_t invalid_frame = -1;
+    run_on_threads(num_threads, [&](i32 thread_idx) {
+        (void)thread_idx;
+        i32 i;
+        while ((i = atomic_fetch_add(&next_frame, 1)) < num_frames) {
+            TrajectoryFrame* frame = traj->frame_buffer.data() + i;
+            frame->index = i;
+            frame->time = t0 + i * dt;
+            if (!extract_frame_data(frame, num_atoms, get_frame_str(i))) {
+                i32 expected = -1;
+                invalid_frame.compare_exchange_strong(expected, i);
+            }
+        }
+    });
+
+    if (invalid_frame != -1) {
+        LOG_ERROR("Could not parse gro frame %i", (i32)invalid_frame);
+        free_trajectory(traj);
+        return false;
+    }
+
+    return true;
+}
+
+bool read_trajectory_num_frames(i32* num_frames, CStringView filename) {
+    ASSERT(num_frames);
+    MappedFile file;
+    if (!map_file(&file, filename)) {
+        LOG_ERROR("Could not read file: '%.*s'.", filename.length(), filename.cstr());
+        return false;
+    }
+    defer { unmap_file(&file); };
+
+    DynamicArray<FrameBytes> frame_bytes;
+    if (!index_frames(&frame_bytes, nullptr, file)) return false;
+    *num_frames = (i32)frame_bytes.size();
+    return true;
+}
+
+bool read_trajectory_frame_bytes(FrameBytes* frame_bytes, CStringView filename) {
+    ASSERT(frame_bytes);
+    MappedFile file;
+    if (!map_file(&file, filename)) {
+        LOG_ERROR("Could not read file: '%.*s'.", filename.length(), filename.cstr());
+        return false;
+    }
+    defer { unmap_file(&file); };
+
+    DynamicArray<FrameBytes> index;
+    if (!index_frames(&index, nullptr, file)) return false;
+    memcpy(frame_bytes, index.data(), index.size_in_bytes());
+    return true;
+}
+
+bool extract_trajectory_frame(TrajectoryFrame* frame, i32 num_atoms, Array<u8> data) {
+    return extract_frame_data(frame, num_atoms, {(const char*)data.beg(), (const char*)data.end()});
+}
+
 }  // namespace gro
@@ -1,9 +1,25 @@
 #pragma once
 
 #include <mol/molecule_structure.h>
+#include <mol/trajectory_utils.h>
 #include <core/string_utils.h>
 
 namespace gro {
-bool load_molecule_from_file(MoleculeStructure* mol, CStringView filename);
-bool load_molecule_from_string(MoleculeStructure* mol, CStringView string);
+// Loads the first frame, the atom records are parsed concurrently on num_threads threads (<= 0 uses all hardware threads)
+bool load_molecule_from_file(MoleculeStructure* mol, CStringView filename, i32 num_threads = 0);
+bool load_molecule_from_string(MoleculeStructure* mol, CStringView string, i32 num_threads = 0);
+
+// Multi-frame gro (e.g. written by trjconv), every frame is a complete gro record: title, atom count, atom records and box.
+// The time of a frame is read from its title ("t= ..."), frames without it are spaced one time unit apart.
+bool load_trajectory_from_file(MoleculeTrajectory* traj, CStringView filename, i32 num_threads = 0);
+bool load_trajectory_from_string(MoleculeTrajectory* traj, CStringView string, i32 num_threads = 0);
+
+// --- Core Trajectory Functionality ---
+bool read_trajectory_num_frames(i32* num_frames, CStringView filename);
+
+// Reads byte offset and length of frames within gro file (num_frames entries)
+bool read_trajectory_frame_bytes(FrameBytes* frame_bytes, CStringView filename);
+
+// Extracts trajectory frame data from a raw-chunk of gro data, matches ExtractFrameFunc
+bool extract_trajectory_frame(TrajectoryFrame* frame, i32 num_atoms, Array<u8> data);
 }
@@ -46,7 +46,9 @@ DynamicArray<HydrogenBondAcceptor> compute_acceptors(const Element in_element[],
 // The distance cutoff sets the distance from bonds to potential acceptors.
 //
 
-DynamicArray<HydrogenBond> compute_bonds(Array<const HydrogenBondDonor> donors, Array<const HydrogenBondAcceptor> acceptors, soa_vec3 in_position, float dist_cutoff, float angle_cutoff) {
+// The box is optional, if it is zero the positions are treated as non periodic
+static DynamicArray<HydrogenBond> compute_bonds(Array<const HydrogenBondDonor> donors, Array<const HydrogenBondAcceptor> acceptors, soa_vec3 in_position,
+                                                const mat3* box, float dist_cutoff, float angle_cutoff) {
     DynamicArray<HydrogenBond> bonds;
 
     const i32 num_acceptors = (i32)acceptors.count;
@@ -64,10 +66,23 @@ DynamicArray<HydrogenBond> compute_bonds(Array<const HydrogenBondDonor> donors,
         acceptor_idx[i] = acceptors[i];
     }
 
-    spatialhash::Frame frame = spatialhash::compute_frame(acceptor_pos_x.data(), acceptor_pos_y.data(), acceptor_pos_z.data(), num_acceptors, vec3(dist_cutoff));
+    spatialhash::Frame frame;
+    if (box) {
+        spatialhash::compute_frame_periodic(&frame, acceptor_pos_x.data(), acceptor_pos_y.data(), acceptor_pos_z.data(), num_acceptors, vec3(dist_cutoff), *box);
+    } else {
+        spatialhash::compute_frame(&frame, acceptor_pos_x.data(), acceptor_pos_y.data(), acceptor_pos_z.data(), num_acceptors, vec3(dist_cutoff));
+    }
+
     for (const auto& don : donors) {
         const vec3 donor_pos_xyz = {in_position.x[don.donor_idx], in_position.y[don.donor_idx], in_position.z[don.donor_idx]};
-        const vec3 hydro_pos_xyz = {in_position.x[don.hydro_idx], in_position.y[don.hydro_idx], in_position.z[don.hydro_idx]};
+        vec3 hydro_pos_xyz = {in_position.x[don.hydro_idx], in_position.y[don.hydro_idx], in_position.z[don.hydro_idx]};
+        if (box) {
+            // Use the image of the hydrogen closest to the donor, in case the pair is split over the boundary
+            vec3 d = hydro_pos_xyz - donor_pos_xyz;
+            d -= frame.period * math::round(d / frame.period);
+            hydro_pos_xyz = donor_pos_xyz + d;
+        }
+        // @NOTE: For periodic frames, pos is the minimum image of the acceptor relative to the hydrogen
         spatialhash::for_each_within(frame, hydro_pos_xyz, dist_cutoff,
                                      [&bonds, &donor_pos_xyz, &hydro_pos_xyz, &acceptor_idx, &don, angle_cutoff](i32 idx, const vec3& pos) {
                                          AtomIdx g_idx = acceptor_idx[idx];
@@ -82,4 +97,14 @@ DynamicArray<HydrogenBond> compute_bonds(Array<const HydrogenBondDonor> donors,
     return bonds;
 }
 
+DynamicArray<HydrogenBond> compute_bonds(Array<const HydrogenBondDonor> donors, Array<const HydrogenBondAcceptor> acceptors, soa_vec3 in_position, float dist_cutoff, float angle_cutoff) {
+    return compute_bonds(donors, acceptors, in_position, nullptr, dist_cutoff, angle_cutoff);
+}
+
+DynamicArray<HydrogenBond> compute_bonds(Array<const HydrogenBondDonor> donors, Array<const HydrogenBondAcceptor> acceptors, soa_vec3 in_position, const mat3& box,
+                                         float dist_cutoff, float angle_cutoff) {
+    const bool has_box = box[0][0] > 0 && box[1][1] > 0 && box[2][2] > 0;
+    return compute_bonds(donors, acceptors, in_position, has_box ? &box : nullptr, dist_cutoff, angle_cutoff);
+}
+
 }  // namespace hydrogen_bond
@@ -18,6 +18,10 @@ DynamicArray<HydrogenBondAcceptor> compute_acceptors(const Element in_elements[]
 DynamicArray<HydrogenBondDonor>    compute_donors(const MoleculeStructure& mol);
 DynamicArray<HydrogenBond>         compute_bonds(Array<const HydrogenBondDonor> in_donors, Array<const HydrogenBondAcceptor> in_acceptors, const soa_vec3 in_pos,
                                          float dist_cutoff = 3.f, float angle_cutoff = math::deg_to_rad(20.f));
+// Periodic variant, acceptors are searched across the boundaries of the simulation box (e.g. TrajectoryFrame::box) using the minimum image convention.
+// Falls back to the non periodic search if the box is empty.
+DynamicArray<HydrogenBond>         compute_bonds(Array<const HydrogenBondDonor> in_donors, Array<const HydrogenBondAcceptor> in_acceptors, const soa_vec3 in_pos,
+                                         const mat3& box, float dist_cutoff = 3.f, float angle_cutoff = math::deg_to_rad(20.f));
 
 /*
 void compute_bonds_trajectory(HydrogenBondTrajectory* hbt, const MoleculeDynamic& dyn, float dist_cutoff, float angle_cutoff);
@@ -9,6 +9,7 @@
 #include <core/string_utils.h>
 #include <core/log.h>
 #include <core/file.h>
+#include <core/sync.h>
 
 #include <ctype.h>
 #include <stdio.h>
@@ -30,21 +31,6 @@ inline CStringView extract_next_model(CStringView& pdb_string) {
     return {};
 }
 
-inline void extract_position(float* x, float* y, float* z, CStringView line) {
-    // SLOW 🐢
-    // sscanf(line.substr(30).ptr, "%8f%8f%8f", &pos.x, &pos.y, &pos.z);
-
-    // FASTER 🚴
-    // pos.x = to_float(line.substr(30, 8));
-    // pos.y = to_float(line.substr(38, 8));
-    // pos.z = to_float(line.substr(46, 8));
-
-    // FASTEST 🏎️💨
-    *x = str_to_float(line.substr(30, 8));
-    *y = str_to_float(line.substr(38, 8));
-    *z = str_to_float(line.substr(46, 8));
-}
-
 inline void extract_simulation_box(mat3* box, CStringView line) {
     vec3 dim(to_float(line.substr(6, 9)), to_float(line.substr(15, 9)), to_float(line.substr(24, 9)));
     vec3 angles(to_float(line.substr(33, 7)), to_float(line.substr(40, 7)), to_float(line.substr(47, 7)));
@@ -80,185 +66,288 @@ inline void extract_sheet_residue_indices(int* init_idx, int* term_idx, CStringV
     *term_idx = to_int32(line.substr(33, 4));
 }
 
-inline bool extract_trajectory_frame_data(TrajectoryFrame* frame, i32 num_atoms, CStringView mdl_str) {
+// Number of records which are split and parsed together
+constexpr i64 LINE_BATCH_SIZE = 256;
+
+// Parses the coordinate columns of a batch of ATOM/HETATM records
+inline void extract_positions(float* x, float* y, float* z, const CStringView* lines, i64 count) {
+    parse_fixed_width_floats(x, lines, count, 30, 8);
+    parse_fixed_width_floats(y, lines, count, 38, 8);
+    parse_fixed_width_floats(z, lines, count, 46, 8);
+}
+
+// If atom_mask is set, num_atoms is the number of atoms in the model and only the positions of the selected atoms are parsed and stored
+inline bool extract_trajectory_frame_data(TrajectoryFrame* frame, i32 num_atoms, CStringView mdl_str, const Bitfield atom_mask = {}) {
     ASSERT(frame);
     float* x = frame->atom_position.x;
     float* y = frame->atom_position.y;
     float* z = frame->atom_position.z;
     i32 atom_idx = 0;
-    CStringView line;
-    while (mdl_str && (line = extract_line(mdl_str)) && atom_idx < num_atoms) {
-        if (compare_n(line, "ATOM", 4) || compare_n(line, "HETATM", 6)) {
-            extract_position(x + atom_idx, y + atom_idx, z + atom_idx, line);
-            atom_idx++;
-        } else if (compare_n(line, "CRYST1", 6)) {
-            extract_simulation_box(&frame->box, line);
+    i32 dst_idx = 0;
+
+    // Lines are split in batches and the coordinates of all atom records within a batch are parsed together
+    CStringView lines[LINE_BATCH_SIZE];
+    CStringView atom_lines[LINE_BATCH_SIZE];
+    i64 num_lines;
+    while (atom_idx < num_atoms && (num_lines = extract_lines(lines, LINE_BATCH_SIZE, mdl_str)) > 0) {
+        i64 num_atom_lines = 0;
+        for (i64 i = 0; i < num_lines && atom_idx < num_atoms; i++) {
+            const CStringView& line = lines[i];
+            if (compare_n(line, "ATOM", 4) || compare_n(line, "HETATM", 6)) {
+                if (!atom_mask || bitfield::get_bit(atom_mask, atom_idx)) {
+                    atom_lines[num_atom_lines++] = line;
+                }
+                atom_idx++;
+            } else if (compare_n(line, "CRYST1", 6)) {
+                extract_simulation_box(&frame->box, line);
+            }
         }
+        extract_positions(x + dst_idx, y + dst_idx, z + dst_idx, atom_lines, num_atom_lines);
+        dst_idx += (i32)num_atom_lines;
     }
     return atom_idx == num_atoms;
 }
 
-bool load_molecule_from_file(MoleculeStructure* mol, CStringView filename) {
-    FILE* file = fopen(filename, "rb");
-    defer { fclose(file); };
-    if (!file) {
-        LOG_ERROR("Could not open file: %.*s", filename.length(), filename.cstr());
-        return false;
-    }
+// Structure parser which consumes the pdb text in blocks of complete lines, so the text never has to be resident as a whole.
+// The text is parsed twice: the counting pass (mol == nullptr) counts atoms and residues so that the structure can be allocated up front,
+// the filling pass feeds the descriptors straight into the structure. Only the (small) chain and secondary structure lists are accumulated.
+struct StructureParser {
+    MoleculeStructure* mol = nullptr;
+    bool done = false;  // The end of the first model has been reached
+    bool overflow = false;
+
+    i64 num_atoms = 0;
+    i64 num_residues = 0;
+    int current_res_id = -1;
+    char current_chain_id = -1;
 
-    // @NOTE: We pray to the gods above and hope that one single frame will fit in this memory
-    constexpr auto mem_size = MEGABYTES(32);
-    void* mem = TMP_MALLOC(mem_size);
-    defer { TMP_FREE(mem); };
+    // The residue which is currently being filled. Its name is copied since the block it was read from may be gone before the residue is complete.
+    ResidueDescriptor residue{};
+    char residue_name[8] = {};
 
-    auto bytes_read = fread(mem, 1, mem_size, file);
-    CStringView pdb_str = {(const char*)mem, (i64)bytes_read};
+    DynamicArray<char> chain_ids;
+    DynamicArray<ResRange> chain_residue_ranges;
+    DynamicArray<SecondaryStructureDescriptor> secondary_structures;
+};
 
-    return load_molecule_from_string(mol, pdb_str);
+static void commit_residue(StructureParser* p) {
+    if (p->mol && p->num_residues > 0) {
+        set_molecule_structure_residues(p->mol, p->num_residues - 1, &p->residue, 1);
+    }
 }
 
-bool load_molecule_from_string(MoleculeStructure* mol, CStringView pdb_string) {
-    ASSERT(mol);
-    free_molecule_structure(mol);
+static void parse_structure_block(StructureParser* p, CStringView text) {
+    CStringView lines[LINE_BATCH_SIZE];
+    CStringView atom_lines[LINE_BATCH_SIZE];
+    AtomDescriptor atoms[LINE_BATCH_SIZE];
+    float x[LINE_BATCH_SIZE];
+    float y[LINE_BATCH_SIZE];
+    float z[LINE_BATCH_SIZE];
+
+    i64 num_lines;
+    while (!p->done && (num_lines = extract_lines(lines, LINE_BATCH_SIZE, text)) > 0) {
+        const i64 batch_offset = p->num_atoms;
+        i64 num_batch_atoms = 0;
+
+        for (i64 i = 0; i < num_lines; i++) {
+            const CStringView line = lines[i];
+            if (compare_n(line, "ATOM", 4) || compare_n(line, "HETATM", 6)) {
+                if (p->mol && (p->num_atoms == p->mol->atom.count)) {
+                    // The source changed between the passes
+                    p->overflow = p->done = true;
+                    break;
+                }
 
-    DynamicArray<AtomDescriptor> atoms;
-    DynamicArray<ResidueDescriptor> residues;
-    DynamicArray<ChainDescriptor> chains;
-    DynamicArray<BondDescriptor> bonds;
-    DynamicArray<SecondaryStructureDescriptor> secondary_structures;
+                int res_id = to_int(line.substr(22, 4));
+                char chain_id = line[21];
 
-    int current_res_id = -1;
-    char current_chain_id = -1;
-    CStringView line;
-    while (pdb_string && (line = extract_line(pdb_string))) {
-        if (compare_n(line, "ATOM", 4) || compare_n(line, "HETATM", 6)) {
-            int res_id = to_int(line.substr(22, 4));
-            char chain_id = line[21];
-
-            // New Chain
-            if (current_chain_id != chain_id && chain_id != ' ') {
-                ChainDescriptor& chain = chains.allocate_back();
-                chain.id = line.substr(21, 1);
-                chain.residue_range = {(ResIdx)residues.size(), (ResIdx)residues.size()};
-                current_chain_id = chain_id;
-            }
+                // New Chain
+                if (p->current_chain_id != chain_id && chain_id != ' ') {
+                    if (p->mol) {
+                        p->chain_ids.push_back(chain_id);
+                        p->chain_residue_ranges.push_back({(ResIdx)p->num_residues, (ResIdx)p->num_residues});
+                    }
+                    p->current_chain_id = chain_id;
+                }
 
-            // New Residue
-            if (res_id != current_res_id) {
-                ResidueDescriptor& res = residues.allocate_back();
-                res.name = trim(line.substr(17, 3));
-                res.id = res_id;
-                res.atom_range = {(AtomIdx)atoms.size(), (AtomIdx)atoms.size()};
-                current_res_id = res_id;
+                // New Residue
+                if (res_id != p->current_res_id) {
+                    if (p->mol && p->num_residues == p->mol->residue.count) {
+                        p->overflow = p->done = true;
+                        break;
+                    }
+                    commit_residue(p);
+                    const CStringView name = trim(line.substr(17, 3));
+                    const i64 name_len = name.length() < (i64)sizeof(p->residue_name) ? name.length() : (i64)sizeof(p->residue_name);
+                    memcpy(p->residue_name, name.beg(), name_len);
+                    p->residue.name = {p->residue_name, name_len};
+                    p->residue.id = res_id;
+                    p->residue.atom_range = {(AtomIdx)p->num_atoms, (AtomIdx)p->num_atoms};
+                    p->current_res_id = res_id;
+                    p->num_residues++;
+
+                    if (p->chain_residue_ranges.size() > 0) {
+                        p->chain_residue_ranges.back().end++;
+                    }
+                }
 
-                if (chains.size() > 0) {
-                    chains.back().residue_range.end++;
+                if (p->mol) {
+                    AtomDescriptor& atom = atoms[num_batch_atoms];
+                    atom.name = trim(line.substr(12, 4));
+                    extract_element(&atom.element, line);
+                    atom.residue_index = (ResIdx)p->num_residues - 1;
+                    atom_lines[num_batch_atoms] = line;
+                    num_batch_atoms++;
+                }
+                p->residue.atom_range.end++;
+                p->num_atoms++;
+                /* } else if (compare_n(line, "BOND", 4)) { */
+            } else if (compare_n(line, "HELIX", 5)) {
+                if (p->mol) {
+                    SecondaryStructureDescriptor& ss = p->secondary_structures.allocate_back();
+                    ss.type = SecondaryStructure::Helix;
+                    extract_helix_residue_indices(&ss.residue_range.beg, &ss.residue_range.end, line);
                 }
+            } else if (compare_n(line, "SHEET", 5)) {
+                if (p->mol) {
+                    SecondaryStructureDescriptor& ss = p->secondary_structures.allocate_back();
+                    ss.type = SecondaryStructure::Sheet;
+                    extract_sheet_residue_indices(&ss.residue_range.beg, &ss.residue_range.end, line);
+                }
+            } else if (compare_n(line, "ENDMDL", 6) || compare_n(line, "END", 3)) {
+                p->done = true;
+                break;
             }
+        }
 
-            AtomDescriptor& atom = atoms.allocate_back();
-            extract_position(&atom.x, &atom.y, &atom.z, line);
-            atom.name = trim(line.substr(12, 4));
-            extract_element(&atom.element, line);
-            atom.residue_index = (ResIdx)residues.size() - 1;
-
-            residues.back().atom_range.end++;
-            /* } else if (compare_n(line, "BOND", 4)) { */
-        } else if (compare_n(line, "HELIX", 5)) {
-            SecondaryStructureDescriptor& ss = secondary_structures.allocate_back();
-            ss.type = SecondaryStructure::Helix;
-            extract_helix_residue_indices(&ss.residue_range.beg, &ss.residue_range.end, line);
-        } else if (compare_n(line, "SHEET", 5)) {
-            SecondaryStructureDescriptor& ss = secondary_structures.allocate_back();
-            ss.type = SecondaryStructure::Sheet;
-            extract_sheet_residue_indices(&ss.residue_range.beg, &ss.residue_range.end, line);
-        } else if (compare_n(line, "ENDMDL", 6) || compare_n(line, "END", 3)) {
-            break;
+        // Names are interned when the atoms are set, so the batch has to be flushed before the lines it refers to are gone
+        if (num_batch_atoms > 0) {
+            extract_positions(x, y, z, atom_lines, num_batch_atoms);
+            for (i64 i = 0; i < num_batch_atoms; i++) {
+                atoms[i].x = x[i];
+                atoms[i].y = y[i];
+                atoms[i].z = z[i];
+            }
+            set_molecule_structure_atoms(p->mol, batch_offset, atoms, num_batch_atoms);
         }
     }
+}
 
-    /*
-    auto masses = compute_atom_masses(elements);
-    auto radii = compute_atom_radii(elements);
-    auto covalent_bonds = compute_covalent_bonds(residues, pos_x.data(), pos_y.data(), pos_z.data(), elements.data(), num_atoms);
-    auto sequences = compute_sequences(residues);
-    auto backbone_segments = compute_backbone_segments(residues, labels);
-    auto backbone_sequences = compute_backbone_sequences(backbone_segments, residues);
-    auto donors = hydrogen_bond::compute_donors(elements, residue_indices, residues, covalent_bonds);
-    auto acceptors = hydrogen_bond::compute_acceptors(elements);
-    */
-
-    MoleculeStructureDescriptor desc {};
-    desc.num_atoms = atoms.size();
-    desc.atoms = atoms.data();
-    desc.num_residues = residues.size();
-    desc.residues = residues.data();
-    desc.num_chains = chains.size();
-    desc.chains = chains.data();
-    desc.num_secondary_structures = secondary_structures.size();
-    desc.secondary_structures = secondary_structures.data();
-
-    init_molecule_structure(mol, desc);
-
-    /*
-    for (i32 i = 0; i < num_atoms; i++) {
-        mol->atom.res_idx[i] = -1;
-        mol->atom.chain_idx[i] = -1;
-        mol->atom.seq_idx[i] = -1;
+static bool finish_structure(StructureParser* p) {
+    ASSERT(p->mol);
+    if (p->overflow || p->num_atoms != p->mol->atom.count || p->num_residues != p->mol->residue.count) {
+        LOG_ERROR("Pdb structure changed while it was being read");
+        free_molecule_structure(p->mol);
+        return false;
     }
+    commit_residue(p);
 
-    for (SeqIdx seq_idx = 0; seq_idx < (SeqIdx)sequences.size(); seq_idx++) {
-        for (AtomIdx i = sequences[seq_idx].atom_range.beg; i != sequences[seq_idx].atom_range.end; i++) {
-            mol->atom.seq_idx[i] = seq_idx;
-        }
+    DynamicArray<ChainDescriptor> chains(p->chain_ids.size());
+    for (i64 i = 0; i < chains.size(); i++) {
+        chains[i].id = {p->chain_ids.data() + i, 1};
+        chains[i].residue_range = p->chain_residue_ranges[i];
     }
 
-    for (ChainIdx chain_idx = 0; chain_idx < (ChainIdx)chains.size(); chain_idx++) {
-        for (AtomIdx i = chains[chain_idx].atom_range.beg; i != chains[chain_idx].atom_range.end; i++) {
-            mol->atom.chain_idx[i] = chain_idx;
+    return finalize_molecule_structure(p->mol, chains.data(), chains.size(), p->secondary_structures.data(), p->secondary_structures.size());
+}
+
+// Reads the file in blocks and passes the complete lines of each block to func(CStringView block), stops early if func returns false.
+// Memory is bounded by the block size, a line which does not fit in a block is split.
+template <typename Func>
+static void for_each_block_of_lines(FILE* file, Func func) {
+    constexpr i64 block_size = MEGABYTES(4);
+    char* buf = (char*)MALLOC(block_size);
+    defer { FREE(buf); };
+
+    i64 carry = 0;
+    while (true) {
+        const i64 bytes_read = (i64)fread(buf + carry, 1, block_size - carry, file);
+        const i64 size = carry + bytes_read;
+        if (size == 0) break;
+        const bool eof = bytes_read < block_size - carry;
+
+        // The partial line at the end of the block is carried over to the next block
+        i64 end = size;
+        if (!eof) {
+            while (end > 0 && buf[end - 1] != '\n') end--;
+            if (end == 0) end = size;
         }
+
+        if (!func(CStringView(buf, end)) || eof) break;
+        carry = size - end;
+        memmove(buf, buf + end, carry);
     }
+}
 
-    // Copy data into molecule
-    memcpy(mol->atom.position.x, pos_x.data(), pos_x.size_in_bytes());
-    memcpy(mol->atom.position.y, pos_y.data(), pos_y.size_in_bytes());
-    memcpy(mol->atom.position.z, pos_z.data(), pos_z.size_in_bytes());
-    memcpy(mol->atom.radius, radii.data(), num_atoms * sizeof(float));
-    memcpy(mol->atom.mass, masses.data(), num_atoms * sizeof(float));
-    memcpy(mol->atom.element, elements.data(), elements.size_in_bytes());
-    memcpy(mol->atom.name, labels.data(), labels.size_in_bytes());
-    memcpy(mol->atom.res_idx, residue_indices.data(), residue_indices.size_in_bytes());
-
-    memcpy(mol->residues.data(), residues.data(), residues.size_in_bytes());
-    memcpy(mol->chains.data(), chains.data(), chains.size_in_bytes());
-    memcpy(mol->sequences.data(), sequences.data(), sequences.size_in_bytes());
-    memcpy(mol->covalent_bonds.data(), covalent_bonds.data(), covalent_bonds.size_in_bytes());
-    memcpy(mol->backbone.segments.data(), backbone_segments.data(), backbone_segments.size_in_bytes());
-    memcpy(mol->backbone.sequences.data(), backbone_sequences.data(), backbone_sequences.size_in_bytes());
-    memcpy(mol->hydrogen_bond.donors.data(), donors.data(), donors.size_in_bytes());
-    memcpy(mol->hydrogen_bond.acceptors.data(), acceptors.data(), acceptors.size_in_bytes());
-
-    for (const auto& bb_seq : mol->backbone.sequences) {
-        auto segments = get_backbone(*mol, bb_seq);
-        compute_backbone_angles(mol->backbone.angles.data(), segments.data(), mol->atom.position.x, mol->atom.position.y, mol->atom.position.z,
-                                segments.size());
+bool load_molecule_from_file(MoleculeStructure* mol, CStringView filename) {
+    ASSERT(mol);
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        LOG_ERROR("Could not open file: %.*s", filename.length(), filename.cstr());
+        return false;
     }
-    */
+    defer { fclose(file); };
 
-    return true;
+    StructureParser count_pass;
+    for_each_block_of_lines(file, [&count_pass](CStringView block) {
+        parse_structure_block(&count_pass, block);
+        return !count_pass.done;
+    });
+
+    if (!allocate_molecule_structure(mol, count_pass.num_atoms, count_pass.num_residues)) {
+        LOG_ERROR("Could not allocate memory for molecule structure");
+        return false;
+    }
+
+    rewind(file);
+    StructureParser fill_pass;
+    fill_pass.mol = mol;
+    for_each_block_of_lines(file, [&fill_pass](CStringView block) {
+        parse_structure_block(&fill_pass, block);
+        return !fill_pass.done;
+    });
+
+    return finish_structure(&fill_pass);
+}
+
+bool load_molecule_from_string(MoleculeStructure* mol, CStringView pdb_string) {
+    ASSERT(mol);
+
+    StructureParser count_pass;
+    parse_structure_block(&count_pass, pdb_string);
+
+    if (!allocate_molecule_structure(mol, count_pass.num_atoms, count_pass.num_residues)) {
+        LOG_ERROR("Could not allocate memory for molecule structure");
+        return false;
+    }
+
+    StructureParser fill_pass;
+    fill_pass.mol = mol;
+    parse_structure_block(&fill_pass, pdb_string);
+
+    return finish_structure(&fill_pass);
+}
+
+bool load_trajectory_from_file(MoleculeTrajectory* traj, CStringView filename, i32 num_threads) {
+    return load_trajectory_from_file(traj, filename, TrajectoryLoadOptions{}, num_threads);
 }
 
-bool load_trajectory_from_file(MoleculeTrajectory* traj, CStringView filename) {
-    StringView pdb_string = allocate_and_read_textfile(filename);
-    defer { free_string(&pdb_string); };
-    if (!pdb_string) {
+bool load_trajectory_from_string(MoleculeTrajectory* traj, CStringView pdb_string, i32 num_threads) {
+    return load_trajectory_from_string(traj, pdb_string, TrajectoryLoadOptions{}, num_threads);
+}
+
+bool load_trajectory_from_file(MoleculeTrajectory* traj, CStringView filename, const TrajectoryLoadOptions& opt, i32 num_threads) {
+    MappedFile file;
+    if (!map_file(&file, filename)) {
         LOG_ERROR("Could not load pdb file");
         return false;
     }
-    return load_trajectory_from_string(traj, pdb_string);
+    defer { unmap_file(&file); };
+
+    return load_trajectory_from_string(traj, file, opt, num_threads);
 }
 
-bool load_trajectory_from_string(MoleculeTrajectory* traj, CStringView pdb_string) {
+bool load_trajectory_from_string(MoleculeTrajectory* traj, CStringView pdb_string, const TrajectoryLoadOptions& opt, i32 num_threads) {
     ASSERT(traj);
     free_trajectory(traj);
 
@@ -297,12 +386,65 @@ bool load_trajectory_from_string(MoleculeTrajectory* traj, CStringView pdb_strin
 
     // Time between frames
     const float dt = 1.0f;
-    init_trajectory(traj, info.num_atoms, (i32)model_entries.size(), dt, sim_box);
-    traj->num_frames = (i32)model_entries.size();
 
-    for (i64 i = 0; i < model_entries.size(); i++) {
-        TrajectoryFrame* frame = traj->frame_buffer.data() + i;
-        extract_trajectory_frame_data(frame, traj->num_atoms, model_entries[i]);
+    // Models carry no time stamp, so the time of a model is given by its index
+    DynamicArray<f32> model_times;
+    if (has_time_range(opt)) {
+        model_times.resize(model_entries.size());
+        for (i64 i = 0; i < model_times.size(); i++) model_times[i] = i * dt;
+    }
+    const DynamicArray<i32> models = select_trajectory_frames((i32)model_entries.size(), opt, model_times.empty() ? nullptr : model_times.data());
+    if (models.empty()) {
+        LOG_ERROR("No models in trajectory match the load options");
+        return false;
+    }
+
+    // Only the selected models and atoms are parsed and allocated for
+    i32 num_atoms = info.num_atoms;
+    if (opt.atom_mask) {
+        if (opt.atom_mask.size() != info.num_atoms) {
+            LOG_ERROR("Atom mask does not match the number of atoms in trajectory");
+            return false;
+        }
+        num_atoms = (i32)bitfield::number_of_bits_set(opt.atom_mask);
+        if (num_atoms == 0) {
+            LOG_ERROR("Atom mask does not select any atoms");
+            return false;
+        }
+    }
+
+    const i32 num_frames = (i32)models.size();
+    if (!init_trajectory(traj, num_atoms, num_frames, dt, sim_box)) {
+        return false;
+    }
+    if (opt.atom_mask && !set_trajectory_atom_subset(traj, opt.atom_mask)) {
+        free_trajectory(traj);
+        return false;
+    }
+
+    num_threads = get_num_threads(num_threads);
+    if (num_threads > num_frames) num_threads = num_frames;
+
+    // Each model is extracted into the disjoint position data of its own frame, so models are distributed over the threads
+    atomic_int32_t next_frame = 0;
+    atomic_int32_t invalid_frame = -1;
+    run_on_threads(num_threads, [&](i32 thread_idx) {
+        (void)thread_idx;
+        i32 i;
+        while ((i = atomic_fetch_add(&next_frame, 1)) < num_frames) {
+            TrajectoryFrame* frame = traj->frame_buffer.data() + i;
+            if (!extract_trajectory_frame_data(frame, info.num_atoms, model_entries[models[i]], opt.atom_mask)) {
+                i32 expected = -1;
+                invalid_frame.compare_exchange_strong(expected, models[i]);
+            }
+            frame->time = models[i] * dt;
+        }
+    });
+
+    if (invalid_frame != -1) {
+        LOG_ERROR("Model %i does not contain the expected number of atoms (%i)", (i32)invalid_frame + 1, info.num_atoms);
+        free_trajectory(traj);
+        return false;
     }
 
     return true;
@@ -345,75 +487,89 @@ bool extract_molecule_info(MoleculeInfo* info, CStringView pdb_string) {
     return true;
 }
 
-static bool generate_cache(CStringView filename) {
-    FILE* file = fopen(filename, "rb");
-    if (!file) {
-        LOG_ERROR("Could not open file '.*s", filename.length(), filename.beg());
-        return false;
-    }
-
+static StringBuffer<512> get_cache_file(CStringView filename) {
     StringBuffer<512> cache_file = get_directory(filename);
     cache_file += "/";
     cache_file += get_file_without_extension(filename);
     cache_file += ".cache";
+    return cache_file;
+}
 
-    constexpr CStringView pattern = "\nMODEL ";
-    DynamicArray<FrameBytes> frame_bytes;
-
-    for_each_pattern_found_in_file(filename, pattern, [&frame_bytes](i64 offset) { frame_bytes.push_back({(u64)offset, 0}); });
+// Splits the file into frames at each MODEL record, frame_bytes is empty if the file holds no models.
+// Returns false if the file could not be read.
+static bool index_frames(DynamicArray<FrameBytes>* frame_bytes, CStringView filename) {
+    frame_bytes->clear();
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        LOG_ERROR("Could not open file '%.*s'", (int)filename.length(), filename.beg());
+        return false;
+    }
+    defer { fclose(file); };
 
     fseeki64(file, 0, SEEK_END);
     const u64 file_size = (u64)ftelli64(file);
-    fclose(file);
+    if (file_size == 0) return true;
+
+    constexpr CStringView pattern = "\nMODEL ";
+    DynamicArray<i64> offsets;
+    if (!find_patterns_in_file_parallel(&offsets, filename, pattern)) return false;
 
-    for (i64 i = 0; i < frame_bytes.size() - 1; i++) {
-        frame_bytes[i].extent = frame_bytes[i + 1].offset - frame_bytes[i].offset;
+    frame_bytes->resize(offsets.size());
+    for (i64 i = 0; i < offsets.size(); i++) {
+        const u64 end = i + 1 < offsets.size() ? (u64)offsets[i + 1] : file_size;
+        (*frame_bytes)[i] = {(u64)offsets[i], end - (u64)offsets[i]};
     }
-    frame_bytes.back().extent = file_size - frame_bytes.back().offset;
+    return true;
+}
 
-    u64 UID = generate_UID(filename);
-    return write_trajectory_cache(UID, frame_bytes.data(), frame_bytes.size(), cache_file);
+// Counts the ATOM and HETATM records of the first model, 0 if it cannot be read
+static i32 count_first_model_atoms(CStringView filename, const FrameBytes& first) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) return 0;
+    defer { fclose(file); };
+
+    char* buf = (char*)TMP_MALLOC(first.extent);
+    defer { TMP_FREE(buf); };
+    const i64 bytes_read = read_file_at(file, buf, (i64)first.extent, (i64)first.offset);
+    if (bytes_read != (i64)first.extent) return 0;
+
+    MoleculeInfo info;
+    extract_molecule_info(&info, {buf, bytes_read});
+    return info.num_atoms;
+}
+
+static bool generate_cache(CStringView filename, const DynamicArray<FrameBytes>& frame_bytes) {
+    const u64 UID = generate_UID(filename);
+    // @NOTE: All models of a trajectory are expected to hold the same atoms, so the first one is representative
+    const i32 num_atoms = count_first_model_atoms(filename, frame_bytes[0]);
+    return write_trajectory_cache(UID, frame_bytes.data(), frame_bytes.size(), get_cache_file(filename), num_atoms, TrajectoryFormat::PDB);
 }
 
 bool read_trajectory_num_frames(i32* num_frames, CStringView filename) {
     u64 UID;
     if ((UID = generate_UID(filename)) != INVALID_UID) {
-        StringBuffer<512> cache_file = get_directory(filename);
-        cache_file += "/";
-        cache_file += get_file_without_extension(filename);
-        cache_file += ".cache";
-
         u64 c_UID;
         i64 c_num_frames;
-        if (read_trajectory_cache_header(&c_UID, &c_num_frames, cache_file) && (UID == c_UID)) {
+        if (read_trajectory_cache_header(&c_UID, &c_num_frames, get_cache_file(filename)) && (UID == c_UID)) {
             // Cache is valid
             *num_frames = (i32)c_num_frames;
             return true;
         }
     }
 
-    i32 nframes = 0;
-    bool res = for_each_pattern_found_in_file(filename, "\nMODEL ", [&nframes](i64 offset) {
-        (void)offset;
-        nframes++;
-    });
-
-    if (res) {
-        *num_frames = nframes;
-        return true;
-    }
-
-    return false;
+    // Index the file once and cache the result, read_trajectory_frame_bytes will need it anyway.
+    // The frames are counted from the index itself, so a cache which cannot be written does not cost a second scan.
+    DynamicArray<FrameBytes> frame_bytes;
+    if (!index_frames(&frame_bytes, filename)) return false;
+    if (!frame_bytes.empty()) generate_cache(filename, frame_bytes);
+    *num_frames = (i32)frame_bytes.size();
+    return true;
 }
 
 bool read_trajectory_frame_bytes(FrameBytes* frame_bytes, CStringView filename) {
     u64 UID;
     if ((UID = generate_UID(filename)) != INVALID_UID) {
-        StringBuffer<512> cache_file = get_directory(filename);
-        cache_file += "/";
-        cache_file += get_file_without_extension(filename);
-        cache_file += ".cache";
-
+        const StringBuffer<512> cache_file = get_cache_file(filename);
         u64 c_UID;
         i64 c_num_frames;
         if (read_trajectory_cache_header(&c_UID, &c_num_frames, cache_file) && (UID == c_UID)) {
@@ -422,10 +578,11 @@ bool read_trajectory_frame_bytes(FrameBytes* frame_bytes, CStringView filename)
         } else {
             // Cache is invalid
             // Regenerate data
-            if (generate_cache(filename)) {
-                if (read_trajectory_cache_header(&c_UID, &c_num_frames, cache_file) && (UID == c_UID)) {
-                    return read_trajectory_cache(frame_bytes, cache_file);
-                }
+            DynamicArray<FrameBytes> index;
+            if (index_frames(&index, filename) && !index.empty()) {
+                generate_cache(filename, index);
+                memcpy(frame_bytes, index.data(), index.size_in_bytes());
+                return true;
             }
         }
     }
@@ -17,9 +17,14 @@ struct MoleculeInfo {
 bool load_molecule_from_file(MoleculeStructure* mol, CStringView filename);
 bool load_molecule_from_string(MoleculeStructure* mol, CStringView string);
 
-// Loads entire trajectory
-bool load_trajectory_from_file(MoleculeTrajectory* traj, CStringView filename);
-bool load_trajectory_from_string(MoleculeTrajectory* traj, CStringView string);
+// Loads entire trajectory, models are extracted concurrently on num_threads threads (<= 0 uses all hardware threads)
+bool load_trajectory_from_file(MoleculeTrajectory* traj, CStringView filename, i32 num_threads = 0);
+bool load_trajectory_from_string(MoleculeTrajectory* traj, CStringView string, i32 num_threads = 0);
+// Loads only the models selected by the load options, skipped models are never parsed and no memory is allocated for them.
+// Models carry no time stamp, the time of a model is its index within the file.
+// If the options hold an atom mask, only the positions of the selected atoms are parsed and stored (see set_trajectory_atom_subset).
+bool load_trajectory_from_file(MoleculeTrajectory* traj, CStringView filename, const TrajectoryLoadOptions& opt, i32 num_threads = 0);
+bool load_trajectory_from_string(MoleculeTrajectory* traj, CStringView string, const TrajectoryLoadOptions& opt, i32 num_threads = 0);
 
 // Extract molecule info from a pdb string
 bool extract_molecule_info(MoleculeInfo* info, CStringView pdb_string);
@@ -1,5 +1,25 @@
 #include "trajectory_utils.h"
 #include <core/file.h>
+#include <core/log.h>
+
+DynamicArray<i32> select_trajectory_frames(i32 num_frames, const TrajectoryLoadOptions& opt, const f32* frame_times) {
+    ASSERT(opt.stride > 0);
+    ASSERT(frame_times || !has_time_range(opt));
+
+    const i32 beg = opt.frame_range.beg < 0 ? 0 : (opt.frame_range.beg < num_frames ? opt.frame_range.beg : num_frames);
+    const i32 end = (opt.frame_range.end < 0 || num_frames < opt.frame_range.end) ? num_frames : (opt.frame_range.end < beg ? beg : opt.frame_range.end);
+    const i32 stride = opt.stride > 0 ? opt.stride : 1;
+
+    DynamicArray<i32> frames;
+    frames.reserve((end - beg + stride - 1) / stride);
+
+    i32 count = 0;
+    for (i32 i = beg; i < end; i++) {
+        if (frame_times && (frame_times[i] < opt.time_range.beg || opt.time_range.end < frame_times[i])) continue;
+        if (count++ % stride == 0) frames.push_back(i);
+    }
+    return frames;
+}
 
 u64 generate_UID(CStringView filename) {
     // @NOTE: Ideally, we want to use some type of hash generated from the entire file.
@@ -19,49 +39,323 @@ u64 generate_UID(CStringView filename) {
     return INVALID_UID;
 }
 
+#define CACHE_MAGIC 0x0058444942464D44  // 'DMFBIDX'
+#define CACHE_VERSION 2  // Version 2 added last_frame_hash
+
+// Legacy layout, a bare UID followed by packed frame bytes
+struct LegacyFrameBytes {
+    u64 offset : 40;
+    u64 extent : 24;
+};
+
+static bool read_cache_header(TrajectoryCacheHeader* header, FILE* file) {
+    fseeki64(file, 0, SEEK_END);
+    const i64 file_size = ftelli64(file);
+    rewind(file);
+
+    // @NOTE: The magic is checked on its own first, since caches of an earlier version may be smaller than the current header
+    if (file_size >= (i64)sizeof(u64) && fread(&header->magic, sizeof(u64), 1, file) == 1 && header->magic == CACHE_MAGIC) {
+        rewind(file);
+        if (file_size < (i64)sizeof(TrajectoryCacheHeader) || fread(header, sizeof(TrajectoryCacheHeader), 1, file) != 1 || header->version != CACHE_VERSION) {
+            LOG_NOTE("Trajectory cache has an unsupported version and is regenerated");
+            return false;
+        }
+        return file_size == (i64)sizeof(TrajectoryCacheHeader) + header->num_frames * (i64)sizeof(FrameBytes);
+    }
+
+    // Legacy
+    if (file_size < (i64)sizeof(u64)) return false;
+    rewind(file);
+    *header = {};
+    if (fread(&header->UID, sizeof(u64), 1, file) != 1) return false;
+    header->num_frames = (file_size - sizeof(u64)) / sizeof(LegacyFrameBytes);
+    return true;
+}
+
+bool read_trajectory_cache_header(TrajectoryCacheHeader* header, CStringView cache_filename) {
+    ASSERT(header);
+
+    FILE* file = fopen(cache_filename, "rb");
+    if (!file) return false;
+    defer { fclose(file); };
+
+    return read_cache_header(header, file);
+}
+
 // Reads the number of frames and unique ID of trajectory
 bool read_trajectory_cache_header(u64* UID, i64* num_frames, CStringView cache_filename) {
     ASSERT(UID);
     ASSERT(num_frames);
 
-    FILE* file = fopen(cache_filename, "rb");
-    if (file) {
-        fseeki64(file, 0, SEEK_END);
-        const i64 file_size = ftelli64(file);
-        rewind(file);
-        fread(UID, sizeof(u64), 1, file);  // First entry is the UID
-        fclose(file);
-        *num_frames = file_size / sizeof(i64) - 1;  // Minus UID
-        return true;
-    }
-    return false;
+    TrajectoryCacheHeader header;
+    if (!read_trajectory_cache_header(&header, cache_filename)) return false;
+
+    *UID = header.UID;
+    *num_frames = header.num_frames;
+    return true;
 }
 
 // Read trajectory Frame Byte Cache and the unique ID
 bool read_trajectory_cache(FrameBytes* frame_bytes, CStringView cache_filename) {
-    ASSERT(sizeof(FrameBytes) == 8);
+    ASSERT(frame_bytes);
+
     FILE* file = fopen(cache_filename, "rb");
-    if (file) {
-        fseeki64(file, 0, SEEK_END);
-        const i64 file_size = ftelli64(file);
-        rewind(file);
-        const i64 num_frames = file_size / sizeof(i64) - 1;  // Minus UID
-        fseeki64(file, sizeof(u64), SEEK_SET); // Skip UID
-        fread(frame_bytes, sizeof(FrameBytes), num_frames, file);
-        fclose(file);
-        return true;
+    if (!file) return false;
+    defer { fclose(file); };
+
+    TrajectoryCacheHeader header;
+    if (!read_cache_header(&header, file)) return false;
+
+    if (header.magic == CACHE_MAGIC) {
+        return (i64)fread(frame_bytes, sizeof(FrameBytes), header.num_frames, file) == header.num_frames;
     }
-    return false;
+
+    static_assert(sizeof(LegacyFrameBytes) == 8, "Legacy frame bytes must be packed into 8 bytes");
+    fseeki64(file, sizeof(u64), SEEK_SET);  // Skip UID
+    for (i64 i = 0; i < header.num_frames; i++) {
+        LegacyFrameBytes legacy;
+        if (fread(&legacy, sizeof(legacy), 1, file) != 1) return false;
+        frame_bytes[i] = {legacy.offset, legacy.extent};
+    }
+    return true;
 }
 
 // Write trajectory Frame Byte Cache with a unique ID (fingerprint)
-bool write_trajectory_cache(u64 UID, const FrameBytes* frame_bytes, i64 num_frames, CStringView cache_filename) {
+bool write_trajectory_cache(u64 UID, const FrameBytes* frame_bytes, i64 num_frames, CStringView cache_filename, i32 num_atoms, TrajectoryFormat format,
+                            u64 last_frame_hash) {
     FILE* file = fopen(cache_filename, "wb");
     if (file) {
-        fwrite(&UID, sizeof(u64), 1, file);
+        TrajectoryCacheHeader header;
+        header.magic = CACHE_MAGIC;
+        header.version = CACHE_VERSION;
+        header.format = format;
+        header.num_atoms = num_atoms;
+        header.num_frames = num_frames;
+        header.UID = UID;
+        header.last_frame_hash = last_frame_hash;
+        fwrite(&header, sizeof(header), 1, file);
         fwrite(frame_bytes, sizeof(FrameBytes), num_frames, file);
         fclose(file);
         return true;
     }
     return false;
 }
+
+#define MDTC_MAGIC 0x4354444D  // 'MDTC'
+#define MDTC_VERSION 1
+#define MDTC_ALIGNMENT 64
+
+struct BinaryCacheHeader {
+    u32 magic = MDTC_MAGIC;
+    u32 version = MDTC_VERSION;
+    u64 UID = INVALID_UID;
+    i32 num_atoms = 0;
+    i32 num_frames = 0;
+    f32 total_simulation_time = 0;
+    i32 simulation_type = 0;
+    u64 frame_offset = 0;           // Byte offset to the BinaryCacheFrame entries
+    u64 position_offset[3] = {};    // Byte offsets to the x, y and z planes, each aligned to MDTC_ALIGNMENT
+};
+
+struct BinaryCacheFrame {
+    i32 index;
+    f32 time;
+    mat3 box;
+};
+
+static inline u64 align_offset(u64 offset) { return (offset + MDTC_ALIGNMENT - 1) & ~(u64)(MDTC_ALIGNMENT - 1); }
+
+static BinaryCacheHeader compute_binary_cache_header(u64 UID, i32 num_atoms, i32 num_frames) {
+    const u64 plane_size = (u64)num_atoms * num_frames * sizeof(float);
+    BinaryCacheHeader header;
+    header.UID = UID;
+    header.num_atoms = num_atoms;
+    header.num_frames = num_frames;
+    header.frame_offset = sizeof(BinaryCacheHeader);
+    header.position_offset[0] = align_offset(header.frame_offset + num_frames * sizeof(BinaryCacheFrame));
+    header.position_offset[1] = align_offset(header.position_offset[0] + plane_size);
+    header.position_offset[2] = align_offset(header.position_offset[1] + plane_size);
+    return header;
+}
+
+bool write_trajectory_binary_cache(const MoleculeTrajectory& traj, u64 UID, CStringView cache_filename) {
+    ASSERT(!is_trajectory_streamed(traj));
+    if (is_trajectory_subset(traj)) {
+        // @NOTE: The cache is keyed on the trajectory file alone, a subset would be mistaken for the full trajectory when loaded
+        LOG_ERROR("Cannot write binary cache of a trajectory which only holds an atom subset");
+        return false;
+    }
+
+    FILE* file = fopen(cache_filename, "wb");
+    if (!file) {
+        LOG_ERROR("Could not open file '%.*s'", (int)cache_filename.length(), cache_filename.beg());
+        return false;
+    }
+    defer { fclose(file); };
+
+    BinaryCacheHeader header = compute_binary_cache_header(UID, traj.num_atoms, traj.num_frames);
+    header.total_simulation_time = traj.total_simulation_time;
+    header.simulation_type = (i32)traj.simulation_type;
+    fwrite(&header, sizeof(header), 1, file);
+
+    for (const auto& frame : traj.frame_buffer) {
+        const BinaryCacheFrame entry = {frame.index, frame.time, frame.box};
+        fwrite(&entry, sizeof(entry), 1, file);
+    }
+
+    const u8 zero[MDTC_ALIGNMENT] = {};
+    for (i32 c = 0; c < 3; c++) {
+        const i64 pad = header.position_offset[c] - ftelli64(file);
+        ASSERT(0 <= pad && pad < MDTC_ALIGNMENT);
+        fwrite(zero, 1, pad, file);
+        for (const auto& frame : traj.frame_buffer) {
+            const float* plane = c == 0 ? frame.atom_position.x : (c == 1 ? frame.atom_position.y : frame.atom_position.z);
+            if (fwrite(plane, sizeof(float), traj.num_atoms, file) != (size_t)traj.num_atoms) {
+                LOG_ERROR("Could not write trajectory binary cache");
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool load_trajectory_binary_cache(MoleculeTrajectory* traj, u64 UID, CStringView cache_filename) {
+    ASSERT(traj);
+
+    MappedFile mapped;
+    if (!map_file(&mapped, cache_filename, MapAccess::Random, true)) return false;
+
+    if (mapped.size < (i64)sizeof(BinaryCacheHeader)) {
+        unmap_file(&mapped);
+        return false;
+    }
+
+    const BinaryCacheHeader& header = *(const BinaryCacheHeader*)mapped.data;
+    if (header.magic != MDTC_MAGIC || header.version != MDTC_VERSION || header.UID != UID || header.num_atoms <= 0 || header.num_frames <= 0) {
+        unmap_file(&mapped);
+        return false;
+    }
+
+    const BinaryCacheHeader expected = compute_binary_cache_header(UID, header.num_atoms, header.num_frames);
+    const u64 plane_size = (u64)header.num_atoms * header.num_frames * sizeof(float);
+    if (memcmp(header.position_offset, expected.position_offset, sizeof(expected.position_offset)) != 0 ||
+        header.frame_offset != expected.frame_offset || (u64)mapped.size < header.position_offset[2] + plane_size) {
+        LOG_ERROR("Trajectory binary cache '%.*s' is corrupt", (int)cache_filename.length(), cache_filename.beg());
+        unmap_file(&mapped);
+        return false;
+    }
+
+    const i32 num_atoms = header.num_atoms;
+    const i32 num_frames = header.num_frames;
+    TrajectoryFrame* frame_mem = (TrajectoryFrame*)MALLOC(num_frames * sizeof(TrajectoryFrame));
+    if (!frame_mem) {
+        LOG_ERROR("Could not allocate memory for trajectory frames");
+        unmap_file(&mapped);
+        return false;
+    }
+
+    free_trajectory(traj);
+    traj->num_atoms = num_atoms;
+    traj->num_frames = num_frames;
+    traj->total_simulation_time = header.total_simulation_time;
+    traj->simulation_type = (SimulationType)header.simulation_type;
+    traj->position_data.x = (float*)(mapped.data + header.position_offset[0]);
+    traj->position_data.y = (float*)(mapped.data + header.position_offset[1]);
+    traj->position_data.z = (float*)(mapped.data + header.position_offset[2]);
+    traj->frame_buffer = {frame_mem, num_frames};
+    traj->mapped_file = mapped;
+
+    ASSERT(IS_ALIGNED(traj->position_data.x, MDTC_ALIGNMENT));
+    ASSERT(IS_ALIGNED(traj->position_data.y, MDTC_ALIGNMENT));
+    ASSERT(IS_ALIGNED(traj->position_data.z, MDTC_ALIGNMENT));
+
+    const BinaryCacheFrame* entries = (const BinaryCacheFrame*)(mapped.data + header.frame_offset);
+    for (i32 i = 0; i < num_frames; i++) {
+        traj->frame_buffer[i].index = entries[i].index;
+        traj->frame_buffer[i].time = entries[i].time;
+        traj->frame_buffer[i].box = entries[i].box;
+        traj->frame_buffer[i].atom_position = traj->position_data + (i64)i * num_atoms;
+        traj->frame_buffer[i].velocity = {};
+        traj->frame_buffer[i].force = {};
+    }
+
+    return true;
+}
+
+#define MDTR_MAGIC 0x5254444D  // 'MDTR'
+#define MDTR_VERSION 1
+
+static inline u64 raw_frame_extent(i32 num_atoms) { return sizeof(BinaryCacheFrame) + (u64)num_atoms * 3 * sizeof(float); }
+
+bool write_trajectory_raw(MoleculeTrajectory& traj, CStringView filename, FrameBytes* frame_bytes) {
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        LOG_ERROR("Could not open file '%.*s'", (int)filename.length(), filename.beg());
+        return false;
+    }
+    defer { fclose(file); };
+
+    RawTrajectoryHeader header;
+    header.magic = MDTR_MAGIC;
+    header.version = MDTR_VERSION;
+    header.num_atoms = traj.num_atoms;
+    header.num_frames = traj.num_frames;
+    fwrite(&header, sizeof(header), 1, file);
+
+    const u64 extent = raw_frame_extent(traj.num_atoms);
+    for (i32 i = 0; i < traj.num_frames; i++) {
+        // @NOTE: Fetches the frame if the trajectory is streamed
+        const TrajectoryFrame& frame = get_trajectory_frame(traj, i);
+        const BinaryCacheFrame entry = {frame.index, frame.time, frame.box};
+        if (fwrite(&entry, sizeof(entry), 1, file) != 1 ||
+            fwrite(frame.atom_position.x, sizeof(float), traj.num_atoms, file) != (size_t)traj.num_atoms ||
+            fwrite(frame.atom_position.y, sizeof(float), traj.num_atoms, file) != (size_t)traj.num_atoms ||
+            fwrite(frame.atom_position.z, sizeof(float), traj.num_atoms, file) != (size_t)traj.num_atoms) {
+            LOG_ERROR("Could not write trajectory to file '%.*s'", (int)filename.length(), filename.beg());
+            return false;
+        }
+        if (frame_bytes) frame_bytes[i] = {sizeof(RawTrajectoryHeader) + i * extent, extent};
+    }
+
+    return true;
+}
+
+bool read_trajectory_raw_header(RawTrajectoryHeader* header, CStringView filename) {
+    ASSERT(header);
+    FILE* file = fopen(filename, "rb");
+    if (!file) return false;
+    defer { fclose(file); };
+
+    if (fread(header, sizeof(RawTrajectoryHeader), 1, file) != 1) return false;
+    return header->magic == MDTR_MAGIC && header->version == MDTR_VERSION && header->num_atoms > 0 && header->num_frames >= 0;
+}
+
+bool read_trajectory_raw_frame_bytes(FrameBytes* frame_bytes, const RawTrajectoryHeader& header) {
+    ASSERT(frame_bytes);
+    const u64 extent = raw_frame_extent(header.num_atoms);
+    for (i32 i = 0; i < header.num_frames; i++) {
+        frame_bytes[i] = {sizeof(RawTrajectoryHeader) + i * extent, extent};
+    }
+    return true;
+}
+
+bool extract_trajectory_frame_raw(TrajectoryFrame* frame, i32 num_atoms, Array<u8> raw_data) {
+    ASSERT(frame);
+    if ((u64)raw_data.size_in_bytes() != raw_frame_extent(num_atoms)) {
+        LOG_ERROR("Raw trajectory frame does not match the number of atoms");
+        return false;
+    }
+
+    BinaryCacheFrame entry;
+    memcpy(&entry, raw_data.data(), sizeof(entry));
+    frame->index = entry.index;
+    frame->time = entry.time;
+    frame->box = entry.box;
+
+    const u8* planes = raw_data.data() + sizeof(entry);
+    memcpy(frame->atom_position.x, planes, num_atoms * sizeof(float));
+    memcpy(frame->atom_position.y, planes + num_atoms * sizeof(float), num_atoms * sizeof(float));
+    memcpy(frame->atom_position.z, planes + num_atoms * sizeof(float) * 2, num_atoms * sizeof(float));
+    return true;
+}
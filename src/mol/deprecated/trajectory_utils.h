@@ -2,16 +2,64 @@
 
 #include <core/string_types.h>
 #include <mol/molecule_trajectory.h>
+#include <float.h>
 
 struct FrameBytes {
-    u64 offset : 40; // max: ~1.1TB
-    u64 extent : 24; // max: 16MB
+    u64 offset;
+    u64 extent;
+};
+
+enum class TrajectoryFormat : u32 {
+    Unknown,
+    XTC,
+    PDB
+};
+
+// Header of the frame byte cache (.cache) which precedes the FrameBytes entries
+struct TrajectoryCacheHeader {
+    u64 magic = 0;
+    u32 version = 0;
+    TrajectoryFormat format = TrajectoryFormat::Unknown;
+    i32 num_atoms = 0;      // 0 if unknown
+    i32 reserved = 0;
+    i64 num_frames = 0;
+    u64 UID = 0;
+    u64 last_frame_hash = 0;  // Hash of the bytes of the last indexed frame, used to validate the frames when the cache is extended, 0 if unknown
 };
 
 constexpr u64 INVALID_UID = 0;
 
+// Throughput of a (parallel) trajectory load, used for sizing jobs
+struct TrajectoryLoadStats {
+    i64 num_frames = 0;
+    i64 num_bytes = 0;     // Raw bytes read from file
+    f64 seconds = 0;
+    f64 frames_per_second = 0;
+    f64 megabytes_per_second = 0;
+};
+
+// Partial loading of a trajectory, e.g. every 10th frame within a time window.
+// The frame range is applied first, then the time range and finally the stride, so the stride counts frames which are within both ranges.
+struct TrajectoryLoadOptions {
+    i32 stride = 1;
+    Range<i32> frame_range = {0, -1};          // end < 0 means until the last frame
+    Range<f32> time_range = {-FLT_MAX, FLT_MAX};
+    Bitfield atom_mask{};                       // Optional, only the positions of the selected atoms are stored (see set_trajectory_atom_subset)
+};
+
+// Returns the indices of the frames to keep out of num_frames, frame_times is only required if the options restrict the time range
+DynamicArray<i32> select_trajectory_frames(i32 num_frames, const TrajectoryLoadOptions& opt, const f32* frame_times = nullptr);
+
+inline bool has_time_range(const TrajectoryLoadOptions& opt) { return opt.time_range.beg != -FLT_MAX || opt.time_range.end != FLT_MAX; }
+
 u64 generate_UID(CStringView filename);
 
+// @NOTE: Frame Byte Caches written before the versioned header (a bare UID followed by frame bytes packed into 40-bit offsets and 24-bit extents)
+// are still read, but are always written in the current format.
+
+// Reads the header of the cache, legacy caches have format Unknown and num_atoms 0
+bool read_trajectory_cache_header(TrajectoryCacheHeader* header, CStringView cache_filename);
+
 // Reads the number of frames and unique ID of trajectory
 bool read_trajectory_cache_header(u64* UID, i64* num_frames, CStringView cache_filename);
 
@@ -19,52 +67,85 @@ bool read_trajectory_cache_header(u64* UID, i64* num_frames, CStringView cache_f
 bool read_trajectory_cache(FrameBytes* frame_bytes, CStringView cache_filename);
 
 // Write trajectory Frame Byte Cache with a unique ID (fingerprint)
-bool write_trajectory_cache(u64 UID, const FrameBytes* frame_bytes, i64 num_frames, CStringView cache_filename);
+bool write_trajectory_cache(u64 UID, const FrameBytes* frame_bytes, i64 num_frames, CStringView cache_filename, i32 num_atoms = 0,
+                            TrajectoryFormat format = TrajectoryFormat::Unknown, u64 last_frame_hash = 0);
+
+// Binary trajectory cache (.mdtc) which holds the decoded frames in the same 64-byte aligned SoA plane layout as init_trajectory.
+// Write requires the full trajectory to be resident (not streamed).
+bool write_trajectory_binary_cache(const MoleculeTrajectory& traj, u64 UID, CStringView cache_filename);
 
+// Memory maps the binary cache and points the frames position data directly into the mapping, no data is copied or decoded.
+// The mapping is copy-on-write, so the positions can be modified without touching the cache on disk.
+// Fails if the cache is invalid or its UID does not match.
+bool load_trajectory_binary_cache(MoleculeTrajectory* traj, u64 UID, CStringView cache_filename);
 
+// Raw trajectory (.mdtr), an uncompressed stream of frames which can be written at disk speed.
+// The header is followed by one block per frame: the frame index, time and box followed by the x, y and z planes of the positions.
+struct RawTrajectoryHeader {
+    u32 magic = 0;
+    u32 version = 0;
+    i32 num_atoms = 0;
+    i32 num_frames = 0;
+};
+
+// Writes all frames of the trajectory (streamed trajectories are fetched frame by frame).
+// If frame_bytes is supplied (num_frames entries), it receives the byte range of each frame within the written file.
+bool write_trajectory_raw(MoleculeTrajectory& traj, CStringView filename, FrameBytes* frame_bytes = nullptr);
+
+bool read_trajectory_raw_header(RawTrajectoryHeader* header, CStringView filename);
+// Frames have a fixed size, so the byte ranges follow from the header (header.num_frames entries)
+bool read_trajectory_raw_frame_bytes(FrameBytes* frame_bytes, const RawTrajectoryHeader& header);
+
+// Extracts a frame from its raw block, matches ExtractFrameFunc so raw trajectories can be streamed with init_trajectory_stream
+bool extract_trajectory_frame_raw(TrajectoryFrame* frame, i32 num_atoms, Array<u8> raw_data);
+
+// @NOTE: The non-const accessors make sure that the frame is resident if the trajectory is streamed.
+// The const accessors cannot fetch frames and are therefore only valid for trajectories which are fully resident.
 inline TrajectoryFrame& get_trajectory_frame(MoleculeTrajectory& traj, int frame_index) {
     ASSERT(-1 < frame_index && frame_index < traj.num_frames);
+    if (is_trajectory_streamed(traj)) fetch_trajectory_frame(&traj, frame_index);
     return traj.frame_buffer.ptr[frame_index];
 }
 
 inline const TrajectoryFrame& get_trajectory_frame(const MoleculeTrajectory& traj, int frame_index) {
     ASSERT(-1 < frame_index && frame_index < traj.num_frames);
+    ASSERT(!is_trajectory_streamed(traj));
     return traj.frame_buffer.ptr[frame_index];
 }
 
 inline soa_vec3 get_trajectory_positions(MoleculeTrajectory& traj, int frame_index) {
-    ASSERT(0 <= frame_index && frame_index < traj.num_frames);
-    return traj.frame_buffer.ptr[frame_index].atom_position;
+    return get_trajectory_frame(traj, frame_index).atom_position;
 }
 
 inline const soa_vec3 get_trajectory_positions(const MoleculeTrajectory& traj, int frame_index) {
     ASSERT(0 <= frame_index && frame_index < traj.num_frames);
+    ASSERT(!is_trajectory_streamed(traj));
     return traj.frame_buffer.ptr[frame_index].atom_position;
 }
 
 inline Array<float> get_trajectory_position_x(MoleculeTrajectory& traj, int frame_index) {
-    ASSERT(-1 < frame_index && frame_index < traj.num_frames);
-    return {traj.frame_buffer.ptr[frame_index].atom_position.x, traj.num_atoms};
+    return {get_trajectory_frame(traj, frame_index).atom_position.x, traj.num_atoms};
 }
 inline Array<const float> get_trajectory_position_x(const MoleculeTrajectory& traj, int frame_index) {
     ASSERT(-1 < frame_index && frame_index < traj.num_frames);
+    ASSERT(!is_trajectory_streamed(traj));
     return {traj.frame_buffer.ptr[frame_index].atom_position.x, traj.num_atoms};
 }
 
 inline Array<float> get_trajectory_position_y(MoleculeTrajectory& traj, int frame_index) {
-    ASSERT(-1 < frame_index && frame_index < traj.num_frames);
-    return {traj.frame_buffer.ptr[frame_index].atom_position.y, traj.num_atoms};
+    return {get_trajectory_frame(traj, frame_index).atom_position.y, traj.num_atoms};
 }
 inline Array<const float> get_trajectory_position_y(const MoleculeTrajectory& traj, int frame_index) {
     ASSERT(-1 < frame_index && frame_index < traj.num_frames);
+    ASSERT(!is_trajectory_streamed(traj));
     return {traj.frame_buffer.ptr[frame_index].atom_position.y, traj.num_atoms};
 }
 
 inline Array<float> get_trajectory_position_z(MoleculeTrajectory& traj, int frame_index) {
-    ASSERT(-1 < frame_index && frame_index < traj.num_frames);
-    return {traj.frame_buffer.ptr[frame_index].atom_position.z, traj.num_atoms};
+    return {get_trajectory_frame(traj, frame_index).atom_position.z, traj.num_atoms};
 }
 inline Array<const float> get_trajectory_position_z(const MoleculeTrajectory& traj, int frame_index) {
     ASSERT(-1 < frame_index && frame_index < traj.num_frames);
+    ASSERT(!is_trajectory_streamed(traj));
     return {traj.frame_buffer.ptr[frame_index].atom_position.z, traj.num_atoms};
 }
\ No newline at end of file
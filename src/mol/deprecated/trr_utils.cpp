@@ -0,0 +1,314 @@
+#include "trr_utils.h"
+#include <core/common.h>
+#include <core/log.h>
+#include <core/file.h>
+#include <core/sync.h>
+
+#include <string.h>
+
+namespace trr {
+
+// @NOTE: The frames are plain XDR (big endian) arrays, so they are decoded directly into the SoA planes without going through xdrfile,
+// which would require an AoS scratch buffer per frame and does not expose the sizes required to index the file.
+
+#define TRR_MAGIC 1993
+
+// Upper bound of the frame header: magic, version string, 13 sizes and counts, time and lambda in double precision
+constexpr i64 MAX_HEADER_SIZE = 4 + 8 + 64 + 13 * 4 + 2 * 8;
+
+struct FrameHeader {
+    i32 box_size = 0;
+    i32 vir_size = 0;
+    i32 pres_size = 0;
+    i32 x_size = 0;
+    i32 v_size = 0;
+    i32 f_size = 0;
+    i32 num_atoms = 0;
+    i32 step = 0;
+    f64 time = 0;
+    bool is_double = false;
+    u64 header_size = 0;
+    u64 extent = 0;  // Header and data
+};
+
+inline u32 read_u32_be(const u8* data) { return ((u32)data[0] << 24) | ((u32)data[1] << 16) | ((u32)data[2] << 8) | (u32)data[3]; }
+inline u64 read_u64_be(const u8* data) { return ((u64)read_u32_be(data) << 32) | read_u32_be(data + 4); }
+
+inline f32 read_f32_be(const u8* data) {
+    const u32 v = read_u32_be(data);
+    f32 f;
+    memcpy(&f, &v, sizeof(f));
+    return f;
+}
+
+inline f64 read_f64_be(const u8* data) {
+    const u64 v = read_u64_be(data);
+    f64 d;
+    memcpy(&d, &v, sizeof(d));
+    return d;
+}
+
+inline f64 read_real(const u8* data, bool is_double) { return is_double ? read_f64_be(data) : read_f32_be(data); }
+
+static bool parse_frame_header(FrameHeader* header, const u8* data, i64 size) {
+    ASSERT(header);
+    if (size < 12 || (i32)read_u32_be(data) != TRR_MAGIC) return false;
+
+    // Version string, stored as its length (including the terminator) followed by an xdr string (length and bytes padded to 4)
+    const i64 str_len = (i64)read_u32_be(data + 8);
+    if (str_len > 64) return false;
+    i64 p = 12 + ((str_len + 3) & ~3LL);
+    if (p + 13 * 4 > size) return false;
+
+    i32 v[13];
+    for (i32 i = 0; i < 13; i++) v[i] = (i32)read_u32_be(data + p + i * 4);
+    p += 13 * 4;
+
+    const i32 ir_size = v[0];
+    const i32 e_size = v[1];
+    const i32 top_size = v[5];
+    const i32 sym_size = v[6];
+    if (ir_size || e_size || top_size || sym_size) {
+        // @NOTE: Never written by any recent version of Gromacs
+        LOG_ERROR("Trr frames with input record, energy or topology data are not supported");
+        return false;
+    }
+
+    FrameHeader h;
+    h.box_size = v[2];
+    h.vir_size = v[3];
+    h.pres_size = v[4];
+    h.x_size = v[7];
+    h.v_size = v[8];
+    h.f_size = v[9];
+    h.num_atoms = v[10];
+    h.step = v[11];
+    if (h.num_atoms <= 0) return false;
+
+    // The precision is not stored explicitly, but follows from the size of the data
+    i32 real_size = 0;
+    if (h.box_size) real_size = h.box_size / 9;
+    else if (h.x_size) real_size = (i32)(h.x_size / ((i64)h.num_atoms * 3));
+    else if (h.v_size) real_size = (i32)(h.v_size / ((i64)h.num_atoms * 3));
+    else if (h.f_size) real_size = (i32)(h.f_size / ((i64)h.num_atoms * 3));
+    if (real_size != 4 && real_size != 8) return false;
+    h.is_double = real_size == 8;
+
+    // Every block is either absent or holds exactly one matrix or one vector per atom, anything else is corrupt data
+    const i64 matrix_size = 9 * real_size;
+    const i64 vector_size = (i64)h.num_atoms * 3 * real_size;
+    if ((h.box_size && h.box_size != matrix_size) || (h.vir_size && h.vir_size != matrix_size) || (h.pres_size && h.pres_size != matrix_size)) return false;
+    if ((h.x_size && h.x_size != vector_size) || (h.v_size && h.v_size != vector_size) || (h.f_size && h.f_size != vector_size)) return false;
+
+    if (p + 2 * real_size > size) return false;
+    h.time = read_real(data + p, h.is_double);
+    p += 2 * real_size;  // time and lambda
+
+    h.header_size = (u64)p;
+    h.extent = h.header_size + (u64)h.box_size + h.vir_size + h.pres_size + h.x_size + h.v_size + h.f_size;
+    *header = h;
+    return true;
+}
+
+static void decode_vectors(soa_vec3 dst, const u8* data, i32 num_atoms, bool is_double, f32 scale) {
+    if (is_double) {
+        for (i32 i = 0; i < num_atoms; i++) {
+            const u8* v = data + i * 3 * sizeof(f64);
+            dst.x[i] = (f32)read_f64_be(v + 0) * scale;
+            dst.y[i] = (f32)read_f64_be(v + 8) * scale;
+            dst.z[i] = (f32)read_f64_be(v + 16) * scale;
+        }
+    } else {
+        for (i32 i = 0; i < num_atoms; i++) {
+            const u8* v = data + i * 3 * sizeof(f32);
+            dst.x[i] = read_f32_be(v + 0) * scale;
+            dst.y[i] = read_f32_be(v + 4) * scale;
+            dst.z[i] = read_f32_be(v + 8) * scale;
+        }
+    }
+}
+
+static bool extract_frame_data(TrajectoryFrame* frame, i32 num_atoms, const u8* data, i64 size) {
+    ASSERT(frame);
+    FrameHeader h;
+    if (!parse_frame_header(&h, data, size) || h.num_atoms != num_atoms || (i64)h.extent > size) return false;
+
+    constexpr f32 nm_to_angstrom = 10.0f;
+    const i64 real_size = h.is_double ? 8 : 4;
+    const u8* p = data + h.header_size;
+
+    if (h.box_size) {
+        for (i32 i = 0; i < 3; i++) {
+            for (i32 j = 0; j < 3; j++) {
+                frame->box[i][j] = (f32)read_real(p + (i * 3 + j) * real_size, h.is_double) * nm_to_angstrom;
+            }
+        }
+    }
+    p += h.box_size + h.vir_size + h.pres_size;
+
+    const i64 plane_size = num_atoms * sizeof(float);
+    if (h.x_size) {
+        decode_vectors(frame->atom_position, p, num_atoms, h.is_double, nm_to_angstrom);
+    } else {
+        memset(frame->atom_position.x, 0, plane_size);
+        memset(frame->atom_position.y, 0, plane_size);
+        memset(frame->atom_position.z, 0, plane_size);
+    }
+    p += h.x_size;
+
+    if (frame->velocity.x) {
+        if (h.v_size) {
+            decode_vectors(frame->velocity, p, num_atoms, h.is_double, nm_to_angstrom);
+        } else {
+            memset(frame->velocity.x, 0, plane_size);
+            memset(frame->velocity.y, 0, plane_size);
+            memset(frame->velocity.z, 0, plane_size);
+        }
+    }
+    p += h.v_size;
+
+    if (frame->force.x) {
+        if (h.f_size) {
+            decode_vectors(frame->force, p, num_atoms, h.is_double, 1.0f / nm_to_angstrom);
+        } else {
+            memset(frame->force.x, 0, plane_size);
+            memset(frame->force.y, 0, plane_size);
+            memset(frame->force.z, 0, plane_size);
+        }
+    }
+
+    frame->time = (f32)h.time;
+    return true;
+}
+
+// Walks the frame headers of the file, every frame is self-describing so only the headers are read.
+// channels receives the channels (TrajectoryChannel) which are present in any frame.
+static bool index_frames(DynamicArray<FrameBytes>* frame_bytes, i32* num_atoms, u32* channels, CStringView filename) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        LOG_ERROR("Could not open file '%.*s'", (int)filename.length(), filename.beg());
+        return false;
+    }
+    defer { fclose(file); };
+
+    fseeki64(file, 0, SEEK_END);
+    const i64 file_size = ftelli64(file);
+
+    i32 frame_atoms = 0;
+    u32 present = 0;
+    i64 offset = 0;
+    u8 buf[MAX_HEADER_SIZE];
+    while (offset < file_size) {
+        const i64 bytes = read_file_at(file, buf, file_size - offset < MAX_HEADER_SIZE ? file_size - offset : MAX_HEADER_SIZE, offset);
+        FrameHeader h;
+        if (!parse_frame_header(&h, buf, bytes) || (frame_atoms != 0 && h.num_atoms != frame_atoms)) {
+            LOG_ERROR("Trr frame %i is corrupt", (i32)frame_bytes->size());
+            return false;
+        }
+        if (offset + (i64)h.extent > file_size) {
+            // @NOTE: Trailing bytes are expected while a frame is being written
+            LOG_NOTE("Trajectory '%.*s' ends with an incomplete frame", (int)filename.length(), filename.beg());
+            break;
+        }
+
+        frame_atoms = h.num_atoms;
+        if (h.v_size) present |= TrajectoryChannel_Velocity;
+        if (h.f_size) present |= TrajectoryChannel_Force;
+        frame_bytes->push_back({(u64)offset, h.extent});
+        offset += h.extent;
+    }
+
+    if (frame_bytes->empty()) {
+        LOG_ERROR("Trajectory '%.*s' does not contain any frames", (int)filename.length(), filename.beg());
+        return false;
+    }
+    if (num_atoms) *num_atoms = frame_atoms;
+    if (channels) *channels = present;
+    return true;
+}
+
+bool load_trajectory_from_file(MoleculeTrajectory* traj, CStringView filename, u32 channels, i32 num_threads) {
+    ASSERT(traj);
+
+    DynamicArray<FrameBytes> frame_bytes;
+    i32 num_atoms = 0;
+    u32 present = 0;
+    if (!index_frames(&frame_bytes, &num_atoms, &present, filename)) {
+        return false;
+    }
+
+    MappedFile mapped;
+    if (!map_file(&mapped, filename)) {
+        LOG_ERROR("Could not read file '%.*s'", (int)filename.length(), filename.beg());
+        return false;
+    }
+    defer { unmap_file(&mapped); };
+    const u8* data = (const u8*)mapped.data;
+    const i32 num_frames = (i32)frame_bytes.size();
+
+    f32 dt = 1.0f;
+    if (num_frames > 1) {
+        FrameHeader h0, h1;
+        if (parse_frame_header(&h0, data + frame_bytes[0].offset, frame_bytes[0].extent) &&
+            parse_frame_header(&h1, data + frame_bytes[1].offset, frame_bytes[1].extent)) {
+            dt = (f32)(h1.time - h0.time);
+        }
+    }
+
+    free_trajectory(traj);
+    if (!init_trajectory(traj, num_atoms, num_frames, dt)) {
+        return false;
+    }
+    if (!init_trajectory_channels(traj, channels & present)) {
+        free_trajectory(traj);
+        return false;
+    }
+
+    num_threads = get_num_threads(num_threads);
+    if (num_threads > num_frames) num_threads = num_frames;
+
+    atomic_int32_t next_frame = 0;
+    atomic_int32_t invalid_frame = -1;
+    run_on_threads(num_threads, [&](i32 thread_idx) {
+        (void)thread_idx;
+        i32 i;
+        while ((i = atomic_fetch_add(&next_frame, 1)) < num_frames) {
+            TrajectoryFrame* frame = traj->frame_buffer.data() + i;
+            if (!extract_frame_data(frame, num_atoms, data + frame_bytes[i].offset, (i64)frame_bytes[i].extent)) {
+                i32 expected = -1;
+                invalid_frame.compare_exchange_strong(expected, i);
+            }
+            frame->index = i;
+        }
+    });
+
+    if (invalid_frame != -1) {
+        LOG_ERROR("Could not decode trr frame %i", (i32)invalid_frame);
+        free_trajectory(traj);
+        return false;
+    }
+
+    return true;
+}
+
+bool read_trajectory_num_frames(i32* num_frames, CStringView filename) {
+    ASSERT(num_frames);
+    DynamicArray<FrameBytes> frame_bytes;
+    if (!index_frames(&frame_bytes, nullptr, nullptr, filename)) return false;
+    *num_frames = (i32)frame_bytes.size();
+    return true;
+}
+
+bool read_trajectory_frame_bytes(FrameBytes* frame_bytes, CStringView filename) {
+    ASSERT(frame_bytes);
+    DynamicArray<FrameBytes> index;
+    if (!index_frames(&index, nullptr, nullptr, filename)) return false;
+    memcpy(frame_bytes, index.data(), index.size_in_bytes());
+    return true;
+}
+
+bool extract_trajectory_frame(TrajectoryFrame* frame, i32 num_atoms, Array<u8> raw_data) {
+    return extract_frame_data(frame, num_atoms, raw_data.data(), raw_data.size());
+}
+
+}  // namespace trr
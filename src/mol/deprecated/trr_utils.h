@@ -0,0 +1,25 @@
+#pragma once
+
+#include <mol/molecule_trajectory.h>
+#include <mol/trajectory_utils.h>
+
+// Gromacs full precision trajectories (trr), which may hold velocities and forces in addition to positions.
+// Positions and velocities are converted from nm to Å (nm/ps to Å/ps), forces from kJ/(mol nm) to kJ/(mol Å).
+
+namespace trr {
+
+// Loads entire trajectory, frames are decoded concurrently on num_threads threads (<= 0 uses all hardware threads).
+// The channels (mask of TrajectoryChannel) are only allocated if they are requested and present within the file (see init_trajectory_channels).
+// @NOTE: Gromacs may write positions, velocities and forces at different intervals, data which is missing for a frame is left zeroed.
+bool load_trajectory_from_file(MoleculeTrajectory* traj, CStringView filename, u32 channels = TrajectoryChannel_Velocity | TrajectoryChannel_Force,
+                               i32 num_threads = 0);
+
+// --- Core Trajectory Functionality ---
+bool read_trajectory_num_frames(i32* num_frames, CStringView filename);
+bool read_trajectory_frame_bytes(FrameBytes* frame_bytes, CStringView filename);
+
+// Extracts a frame from its raw bytes, matches ExtractFrameFunc so trr can be streamed with init_trajectory_stream.
+// Velocities and forces are only extracted if the frame has storage for them.
+bool extract_trajectory_frame(TrajectoryFrame* frame, i32 num_atoms, Array<u8> raw_data);
+
+}  // namespace trr
@@ -2,8 +2,11 @@
 #include <core/string_utils.h>
 #include <core/log.h>
 #include <core/file.h>
+#include <core/sync.h>
+#include <mol/molecule_utils.h>
 
 #include <stdio.h>
+#include <chrono>
 #include <xdrfile_xtc.h>
 
 namespace xtc {
@@ -15,21 +18,120 @@ bool read_trajectory_frames_from_file(Array<TrajectoryFrame> frames, i32 num_ato
 }
 */
 
+#define XTC_MAGIC 1995
+#define XTC_HEADER_SIZE 92  // Bytes up until and including the byte count of the compressed coordinates
+
+inline u32 read_u32_be(const u8* data) { return ((u32)data[0] << 24) | ((u32)data[1] << 16) | ((u32)data[2] << 8) | (u32)data[3]; }
+
+// Computes the size of a frame from its header, which has to hold XTC_HEADER_SIZE bytes unless the frame holds 9 atoms or less
+static u64 compute_frame_extent(const u8* header, i32 num_atoms) {
+    if (num_atoms <= 9) {
+        // Small systems are stored uncompressed
+        return 56 + num_atoms * 3 * sizeof(float);
+    }
+    const u64 byte_count = read_u32_be(header + 88);
+    return XTC_HEADER_SIZE + ((byte_count + 3) & ~3ULL);  // Compressed bytes are padded to 4 bytes
+}
+
+// Reads the header of the frame at offset and computes the frame extent, fails if there is no valid (and complete) frame at offset
+static bool read_frame_extent(u64* extent, FILE* file, i64 offset, i64 file_size, i32 num_atoms) {
+    u8 header[XTC_HEADER_SIZE];
+    const i64 header_size = file_size - offset < XTC_HEADER_SIZE ? file_size - offset : XTC_HEADER_SIZE;
+    if (header_size < 56) return false;
+
+    fseeki64(file, offset, SEEK_SET);
+    if ((i64)fread(header, 1, header_size, file) != header_size) return false;
+    if (read_u32_be(header + 0) != XTC_MAGIC || (i32)read_u32_be(header + 4) != num_atoms || (i32)read_u32_be(header + 52) != num_atoms) return false;
+    if (num_atoms > 9 && header_size < XTC_HEADER_SIZE) return false;
+
+    *extent = compute_frame_extent(header, num_atoms);
+    return offset + (i64)*extent <= file_size;
+}
+
+// FNV-1a hash of the bytes of a frame, which identifies the last indexed frame when the cache is extended
+static bool hash_frame_bytes(u64* hash, FILE* file, FrameBytes frame) {
+    u8* buf = (u8*)TMP_MALLOC(frame.extent);
+    defer { TMP_FREE(buf); };
+    if (read_file_at(file, buf, (i64)frame.extent, (i64)frame.offset) != (i64)frame.extent) return false;
+
+    u64 h = 0xCBF29CE484222325ULL;
+    for (u64 i = 0; i < frame.extent; i++) {
+        h ^= buf[i];
+        h *= 0x100000001B3ULL;
+    }
+    *hash = h;
+    return true;
+}
+
+// Extends the frame byte cache when the trajectory file has grown by appending frames (e.g. a running simulation).
+// The bytes of the last indexed frame are validated against their hash and the file is only scanned from that point on, instead of rescanning the whole file.
+// Fails if the existing frames cannot be validated, in which case the cache has to be regenerated from scratch.
+static bool update_cache(CStringView filename, CStringView cache_file) {
+    TrajectoryCacheHeader header;
+    if (!read_trajectory_cache_header(&header, cache_file) || header.num_frames <= 0 || header.last_frame_hash == 0) return false;
+
+    DynamicArray<FrameBytes> frame_bytes(header.num_frames);
+    if (!read_trajectory_cache(frame_bytes.data(), cache_file)) return false;
+
+    FILE* file = fopen(filename, "rb");
+    if (!file) return false;
+    defer { fclose(file); };
+
+    fseeki64(file, 0, SEEK_END);
+    const i64 file_size = ftelli64(file);
+
+    u8 first[8];
+    fseeki64(file, 0, SEEK_SET);
+    if (fread(first, 1, sizeof(first), file) != sizeof(first) || read_u32_be(first) != XTC_MAGIC) return false;
+    const i32 num_atoms = (i32)read_u32_be(first + 4);
+    if (header.num_atoms != 0 && header.num_atoms != num_atoms) return false;
+
+    // The last indexed frame has to be unchanged, otherwise the file was not only appended to (e.g. rewritten by a rerun with the same topology).
+    // A frame header at the same offset is not enough, with 9 atoms or less all frames have the same size.
+    // @NOTE: We rescan the last frame as well, since it may have been partially written when it was indexed.
+    const FrameBytes last = frame_bytes.back();
+    u64 last_hash;
+    if (!hash_frame_bytes(&last_hash, file, last) || last_hash != header.last_frame_hash) return false;
+    u64 extent;
+    if (!read_frame_extent(&extent, file, last.offset, file_size, num_atoms)) return false;
+    frame_bytes.pop_back();
+
+    i64 offset = last.offset;
+    while (read_frame_extent(&extent, file, offset, file_size, num_atoms)) {
+        frame_bytes.push_back({(u64)offset, extent});
+        offset += extent;
+    }
+
+    if (offset != file_size) {
+        // @NOTE: Trailing bytes are expected while a frame is being written, it will be indexed at the next update
+        LOG_NOTE("Trajectory '%.*s' ends with an incomplete frame", (int)filename.length(), filename.beg());
+    }
+
+    if (frame_bytes.empty() || !hash_frame_bytes(&last_hash, file, frame_bytes.back())) return false;
+    const u64 UID = generate_UID(filename);
+    return write_trajectory_cache(UID, frame_bytes.data(), frame_bytes.size(), cache_file, num_atoms, TrajectoryFormat::XTC, last_hash);
+}
+
 static bool generate_cache(CStringView filename) {
+    StringBuffer<512> cache_file = get_directory(filename);
+    cache_file += "/";
+    cache_file += get_file_without_extension(filename);
+    cache_file += ".cache";
+
+    if (update_cache(filename, cache_file)) {
+        return true;
+    }
+
     FILE* file = fopen(filename, "rb");
     if (!file) {
         LOG_ERROR("Could not open file '.*s", filename.length(), filename.beg());
         return false;
     }
+    defer { fclose(file); };
     fseeki64(file, 0, SEEK_END);
     const u64 file_size = (u64)ftelli64(file);
-    fclose(file);
 
     StringBuffer<512> zfilename = filename;  // Make sure it is zero terminated
-    StringBuffer<512> cache_file = get_directory(filename);
-    cache_file += "/";
-    cache_file += get_file_without_extension(filename);
-    cache_file += ".cache";
 
     i64* tmp_offsets;
     i32 num_atoms, num_frames;
@@ -49,8 +151,11 @@ static bool generate_cache(CStringView filename) {
     frame_bytes[num_frames - 1].offset = tmp_offsets[num_frames - 1];
     frame_bytes[num_frames - 1].extent = file_size - tmp_offsets[num_frames - 1];
 
+    u64 last_hash = 0;
+    hash_frame_bytes(&last_hash, file, frame_bytes[num_frames - 1]);
+
     u64 UID = generate_UID(filename);
-    return write_trajectory_cache(UID, frame_bytes, num_frames, cache_file);
+    return write_trajectory_cache(UID, frame_bytes, num_frames, cache_file, num_atoms, TrajectoryFormat::XTC, last_hash);
 }
 
 bool read_trajectory_num_frames(i32* num_frames, CStringView filename) {
@@ -117,23 +222,497 @@ bool decompress_trajectory_frame(TrajectoryFrame* frame, i32 num_atoms, Array<u8
         return false;
     }
 
-    float* pos_buf = (float*)TMP_MALLOC(num_atoms * 3 * sizeof(float));
-    defer { TMP_FREE(pos_buf); };
+    // @NOTE: Scratch for the interleaved output of the xdr decoder, kept alive per thread so it is reused across frames
+    thread_local DynamicArray<float> pos_buf;
+    pos_buf.resize(num_atoms * 3);
 
     int natoms;
     float precision;
-    read_xtc(file, &natoms, &frame->index, &frame->time, (float(&)[3][3])frame->box, (float(*)[3])pos_buf, &precision);
+    read_xtc(file, &natoms, &frame->index, &frame->time, (float(&)[3][3])frame->box, (float(*)[3])pos_buf.data(), &precision);
 
     // nm -> ngstrm
-    for (i32 i = 0; i < num_atoms; i++) {
-        frame->atom_position.x[i] = 10.f * pos_buf[i * 3 + 0];
-        frame->atom_position.y[i] = 10.f * pos_buf[i * 3 + 1];
-        frame->atom_position.z[i] = 10.f * pos_buf[i * 3 + 2];
+    constexpr float nm_to_angstrom = 10.0f;
+    deinterleave(frame->atom_position, pos_buf.data(), num_atoms, nm_to_angstrom);
+    frame->box *= nm_to_angstrom;
+
+    return true;
+}
+
+// Decompresses the frames src_frames[0 .. frame_range.ext()) of the file into frame_range of traj, src_frames == nullptr reads frame_range of the file
+static bool read_frames(MoleculeTrajectory* traj, Range<i32> frame_range, const i32* src_frames, const FrameBytes* frame_bytes, CStringView filename,
+                        i32 num_threads, TrajectoryLoadStats* stats) {
+    ASSERT(traj);
+    ASSERT(frame_bytes);
+    ASSERT(0 <= frame_range.beg && frame_range.end <= traj->num_frames);
+    ASSERT(!is_trajectory_streamed(*traj) || is_trajectory_quantized(*traj));
+
+    const auto t0 = std::chrono::high_resolution_clock::now();
+
+    const i32 num_frames = frame_range.ext();
+    num_threads = get_num_threads(num_threads);
+    if (num_threads > num_frames) num_threads = num_frames > 0 ? num_frames : 1;
+
+    atomic_int32_t next_frame = frame_range.beg;
+    atomic_int64_t bytes_read = 0;
+    std::atomic_bool success = true;
+
+    // Frames are independent byte ranges within the file, so every thread reads with its own file handle
+    // and picks the next unprocessed frame until the range is exhausted.
+    run_on_threads(num_threads, [&](i32 thread_idx) {
+        (void)thread_idx;
+        FILE* file = fopen(filename, "rb");
+        if (!file) {
+            LOG_ERROR("Could not open file '%.*s'", (int)filename.length(), filename.beg());
+            success = false;
+            return;
+        }
+        defer { fclose(file); };
+
+        DynamicArray<u8> buf;
+
+        // Quantized trajectories have no resident position data to decompress into, so frames are decompressed into scratch and then quantized.
+        // The same goes for atom subsets, where the full frame is decompressed into scratch and then compacted.
+        const bool quantized = is_trajectory_quantized(*traj);
+        const bool subset = is_trajectory_subset(*traj);
+        const i32 num_src_atoms = get_trajectory_source_atom_count(*traj);
+        DynamicArray<float> scratch(quantized || subset ? num_src_atoms * 3 : 0);
+        const soa_vec3 scratch_pos = {scratch.data(), scratch.data() + num_src_atoms, scratch.data() + num_src_atoms * 2};
+        DynamicArray<float> subset_scratch(quantized && subset ? traj->num_atoms * 3 : 0);
+        const soa_vec3 subset_pos = {subset_scratch.data(), subset_scratch.data() + traj->num_atoms, subset_scratch.data() + traj->num_atoms * 2};
+
+        i32 i;
+        while (success && (i = atomic_fetch_add(&next_frame, 1)) < frame_range.end) {
+            const i32 src = src_frames ? src_frames[i - frame_range.beg] : i;
+            const FrameBytes& bytes = frame_bytes[src];
+            buf.resize(bytes.extent);
+            fseeki64(file, bytes.offset, SEEK_SET);
+            if (fread(buf.data(), 1, bytes.extent, file) != bytes.extent) {
+                LOG_ERROR("Could not read frame %i from trajectory", src);
+                success = false;
+                return;
+            }
+            TrajectoryFrame* frame = traj->frame_buffer.ptr + i;
+            if (quantized || subset) {
+                TrajectoryFrame tmp_frame = *frame;
+                tmp_frame.atom_position = scratch_pos;
+                if (!decompress_trajectory_frame(&tmp_frame, num_src_atoms, buf)) {
+                    success = false;
+                    return;
+                }
+                frame->time = tmp_frame.time;
+                frame->box = tmp_frame.box;
+                if (quantized) {
+                    if (subset) gather_trajectory_atom_subset(*traj, subset_pos, scratch_pos);
+                    store_trajectory_frame_quantized(traj, i, subset ? subset_pos : scratch_pos);
+                } else {
+                    gather_trajectory_atom_subset(*traj, frame->atom_position, scratch_pos);
+                }
+            } else if (!decompress_trajectory_frame(frame, traj->num_atoms, buf)) {
+                success = false;
+                return;
+            }
+            frame->index = i;
+            atomic_fetch_add(&bytes_read, (i64)bytes.extent);
+        }
+    });
+
+    if (stats) {
+        const auto t1 = std::chrono::high_resolution_clock::now();
+        const f64 seconds = std::chrono::duration<f64>(t1 - t0).count();
+        stats->num_frames = num_frames;
+        stats->num_bytes = bytes_read;
+        stats->seconds = seconds;
+        stats->frames_per_second = seconds > 0 ? num_frames / seconds : 0;
+        stats->megabytes_per_second = seconds > 0 ? (f64)bytes_read / (1024.0 * 1024.0) / seconds : 0;
+    }
+
+    return success;
+}
+
+bool read_trajectory_frames(MoleculeTrajectory* traj, Range<i32> frame_range, const FrameBytes* frame_bytes, CStringView filename, i32 num_threads,
+                            TrajectoryLoadStats* stats) {
+    return read_frames(traj, frame_range, nullptr, frame_bytes, filename, num_threads, stats);
+}
+
+// Reads the time stamps of the frames within frame_range straight from the frame headers, nothing is decompressed
+static bool read_frame_time(f32* time, FILE* file, const FrameBytes& frame_bytes) {
+    u8 data[4];
+    if (read_file_at(file, data, sizeof(data), (i64)frame_bytes.offset + 12) != sizeof(data)) return false;
+    const u32 bits = read_u32_be(data);
+    memcpy(time, &bits, sizeof(f32));
+    return true;
+}
+
+static bool read_frame_times(f32* frame_times, Range<i32> frame_range, const FrameBytes* frame_bytes, CStringView filename) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        LOG_ERROR("Could not open file '%.*s'", (int)filename.length(), filename.beg());
+        return false;
+    }
+    defer { fclose(file); };
+
+    for (i32 i = frame_range.beg; i < frame_range.end; i++) {
+        if (!read_frame_time(frame_times + i, file, frame_bytes[i])) {
+            LOG_ERROR("Could not read time of frame %i from trajectory", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+// window_size > 0 loads the trajectory with quantized storage
+static bool load_trajectory(MoleculeTrajectory* traj, CStringView filename, i32 num_threads, TrajectoryLoadStats* stats, i32 quantized_window_size,
+                            const TrajectoryLoadOptions& opt = {}) {
+    ASSERT(traj);
+    free_trajectory(traj);
+
+    StringBuffer<512> zfilename = filename;  // Make sure it is zero terminated
+    i32 num_atoms = 0;
+    if (read_xtc_natoms(zfilename.cstr(), &num_atoms) != exdrOK || num_atoms == 0) {
+        LOG_ERROR("Could not read number of atoms in trajectory");
+        return false;
+    }
+
+    i32 num_frames = 0;
+    if (!read_trajectory_num_frames(&num_frames, filename) || num_frames == 0) {
+        LOG_ERROR("Could not read number of frames in trajectory");
+        return false;
+    }
+
+    FrameBytes* frame_bytes = (FrameBytes*)TMP_MALLOC(num_frames * sizeof(FrameBytes));
+    defer { TMP_FREE(frame_bytes); };
+    if (!read_trajectory_frame_bytes(frame_bytes, filename)) {
+        LOG_ERROR("Could not read frame offsets in trajectory");
+        return false;
+    }
+
+    // Select the frames to keep up front, so that skipped frames are never decompressed and no memory is allocated for them
+    DynamicArray<f32> frame_times;
+    if (has_time_range(opt)) {
+        frame_times.resize(num_frames);
+        const i32 end = opt.frame_range.end < 0 || num_frames < opt.frame_range.end ? num_frames : opt.frame_range.end;
+        const i32 beg = opt.frame_range.beg < 0 ? 0 : (opt.frame_range.beg < end ? opt.frame_range.beg : end);
+        if (!read_frame_times(frame_times.data(), {beg, end}, frame_bytes, filename)) {
+            return false;
+        }
+    }
+    const DynamicArray<i32> frames = select_trajectory_frames(num_frames, opt, frame_times.empty() ? nullptr : frame_times.data());
+    if (frames.empty()) {
+        LOG_ERROR("No frames in trajectory match the load options");
+        return false;
+    }
+    const i32 num_loaded_frames = (i32)frames.size();
+
+    // Only the selected atoms are allocated for
+    i32 num_loaded_atoms = num_atoms;
+    if (opt.atom_mask) {
+        if (opt.atom_mask.size() != num_atoms) {
+            LOG_ERROR("Atom mask does not match the number of atoms in trajectory");
+            return false;
+        }
+        num_loaded_atoms = (i32)bitfield::number_of_bits_set(opt.atom_mask);
+        if (num_loaded_atoms == 0) {
+            LOG_ERROR("Atom mask does not select any atoms");
+            return false;
+        }
+    }
+
+    if (quantized_window_size > 0) {
+        if (!init_trajectory_quantized(traj, num_loaded_atoms, num_loaded_frames, quantized_window_size)) {
+            return false;
+        }
+    } else if (!init_trajectory(traj, num_loaded_atoms, num_loaded_frames)) {
+        return false;
+    }
+
+    if (opt.atom_mask && !set_trajectory_atom_subset(traj, opt.atom_mask)) {
+        free_trajectory(traj);
+        return false;
+    }
+
+    const bool all_frames = num_loaded_frames == num_frames;
+    if (!read_frames(traj, {0, num_loaded_frames}, all_frames ? nullptr : frames.data(), frame_bytes, filename, num_threads, stats)) {
+        free_trajectory(traj);
+        return false;
+    }
+
+    return true;
+}
+
+bool load_trajectory_from_file(MoleculeTrajectory* traj, CStringView filename, i32 num_threads, TrajectoryLoadStats* stats) {
+    return load_trajectory(traj, filename, num_threads, stats, 0);
+}
+
+bool load_trajectory_from_file(MoleculeTrajectory* traj, CStringView filename, const TrajectoryLoadOptions& opt, i32 num_threads,
+                               TrajectoryLoadStats* stats) {
+    return load_trajectory(traj, filename, num_threads, stats, 0, opt);
+}
+
+bool load_trajectory_from_file_quantized(MoleculeTrajectory* traj, CStringView filename, i32 window_size, i32 num_threads, TrajectoryLoadStats* stats) {
+    ASSERT(window_size > 0);
+    return load_trajectory(traj, filename, num_threads, stats, window_size);
+}
+
+bool update_trajectory(MoleculeTrajectory* traj, CStringView filename, i32 num_threads) {
+    ASSERT(traj);
+
+    i32 num_frames = 0;
+    if (!read_trajectory_num_frames(&num_frames, filename)) {
+        LOG_ERROR("Could not read number of frames in trajectory");
+        return false;
+    }
+    if (num_frames < traj->num_frames) {
+        LOG_ERROR("Trajectory '%.*s' has fewer frames than before, it has to be reloaded", (int)filename.length(), filename.beg());
+        return false;
+    }
+    if (num_frames == traj->num_frames) return true;
+
+    FrameBytes* frame_bytes = (FrameBytes*)TMP_MALLOC(num_frames * sizeof(FrameBytes));
+    defer { TMP_FREE(frame_bytes); };
+    if (!read_trajectory_frame_bytes(frame_bytes, filename)) {
+        LOG_ERROR("Could not read frame offsets in trajectory");
+        return false;
+    }
+
+    const i32 old_num_frames = traj->num_frames;
+    if (!grow_trajectory(traj, num_frames, frame_bytes)) {
+        return false;
+    }
+
+    // Streamed trajectories fetch the new frames on demand
+    if (is_trajectory_streamed(*traj) && !is_trajectory_quantized(*traj)) return true;
+
+    return read_trajectory_frames(traj, {old_num_frames, num_frames}, frame_bytes, filename, num_threads);
+}
+
+bool load_trajectory_from_file_with_binary_cache(MoleculeTrajectory* traj, CStringView filename, i32 num_threads, TrajectoryLoadStats* stats) {
+    ASSERT(traj);
+
+    const u64 UID = generate_UID(filename);
+    StringBuffer<512> cache_file = get_directory(filename);
+    cache_file += "/";
+    cache_file += get_file_without_extension(filename);
+    cache_file += ".mdtc";
+
+    if (UID != INVALID_UID && load_trajectory_binary_cache(traj, UID, cache_file)) {
+        return true;
     }
 
-    frame->box *= 10.0f;
+    if (!load_trajectory_from_file(traj, filename, num_threads, stats)) {
+        return false;
+    }
+
+    if (UID != INVALID_UID && !write_trajectory_binary_cache(*traj, UID, cache_file)) {
+        LOG_WARNING("Could not write trajectory binary cache '%s'", cache_file.cstr());
+    }
 
     return true;
 }
 
+// Upper bound of the size of a compressed frame, the compressor never emits more than 3 * num_atoms * 1.2 ints
+static i64 max_frame_size(i32 num_atoms) { return XTC_HEADER_SIZE + (i64)num_atoms * 3 * sizeof(i32) * 2; }
+
+// Upper bound of the scratch memory which write_trajectory keeps for a batch of frames
+constexpr i64 WRITE_BATCH_MEMORY_BUDGET = MEGABYTES(256);
+
+bool write_trajectory(MoleculeTrajectory& traj, CStringView filename, FrameBytes* frame_bytes, i32 num_threads, f32 precision) {
+    FILE* file = fopen(filename, "wb");
+    if (!file) {
+        LOG_ERROR("Could not open file '%.*s'", (int)filename.length(), filename.beg());
+        return false;
+    }
+    defer { fclose(file); };
+
+    const i32 num_atoms = traj.num_atoms;
+    const i32 num_frames = traj.num_frames;
+    const i64 frame_capacity = max_frame_size(num_atoms);
+    const bool streamed = is_trajectory_streamed(traj);
+
+    // Frames are compressed in batches of one frame per thread, each batch is then written in order.
+    // @NOTE: fetch_trajectory_frame is not thread safe, so frames of streamed trajectories are fetched and packed up front on this thread.
+    num_threads = get_num_threads(num_threads);
+    if (num_threads > num_frames) num_threads = num_frames > 0 ? num_frames : 1;
+
+    // Each slot of a batch holds the interleaved coordinates and the compressed frame, large systems get fewer slots than threads
+    const i64 xyz_stride = (i64)num_atoms * 3;
+    const i64 slot_size = xyz_stride * (i64)sizeof(float) + frame_capacity;
+    const i64 max_batch_size = WRITE_BATCH_MEMORY_BUDGET / slot_size;
+    const i32 batch_size = max_batch_size < num_threads ? (max_batch_size > 1 ? (i32)max_batch_size : 1) : num_threads;
+
+    DynamicArray<float> xyz_mem(batch_size * xyz_stride);
+    DynamicArray<u8> out_mem(batch_size * frame_capacity);
+    DynamicArray<i64> out_size(batch_size);
+    DynamicArray<TrajectoryFrame> batch_frames(batch_size);
+
+    i64 offset = 0;
+    for (i32 batch_beg = 0; batch_beg < num_frames; batch_beg += batch_size) {
+        const i32 batch_count = batch_beg + batch_size < num_frames ? batch_size : num_frames - batch_beg;
+
+        if (streamed) {
+            for (i32 k = 0; k < batch_count; k++) {
+                const TrajectoryFrame* frame = fetch_trajectory_frame(&traj, batch_beg + k);
+                if (!frame) return false;
+                batch_frames[k] = *frame;
+                interleave(xyz_mem.data() + k * xyz_stride, frame->atom_position, num_atoms, 0.1f);  // ngstrm -> nm
+            }
+        }
+
+        atomic_int32_t next_slot = 0;
+        std::atomic_bool success = true;
+        run_on_threads(batch_count, [&](i32 thread_idx) {
+            (void)thread_idx;
+            i32 k;
+            while (success && (k = atomic_fetch_add(&next_slot, 1)) < batch_count) {
+                float* xyz = xyz_mem.data() + k * xyz_stride;
+                if (!streamed) {
+                    batch_frames[k] = traj.frame_buffer[batch_beg + k];
+                    interleave(xyz, batch_frames[k].atom_position, num_atoms, 0.1f);  // ngstrm -> nm
+                }
+
+                u8* out = out_mem.data() + k * frame_capacity;
+                XDRFILE* xdr = xdrfile_mem(out, frame_capacity, "w");
+                if (!xdr) {
+                    LOG_ERROR("Could not open XDR-stream to memory location");
+                    success = false;
+                    return;
+                }
+                mat3 box = batch_frames[k].box;
+                box *= 0.1f;
+                const int result = write_xtc(xdr, num_atoms, batch_frames[k].index, batch_frames[k].time, (float(&)[3][3])box, (float(*)[3])xyz, precision);
+                xdrfile_close(xdr);
+                if (result != exdrOK) {
+                    LOG_ERROR("Could not compress frame %i of trajectory", batch_beg + k);
+                    success = false;
+                    return;
+                }
+                out_size[k] = (i64)compute_frame_extent(out, num_atoms);
+                ASSERT(out_size[k] <= frame_capacity);
+            }
+        });
+        if (!success) return false;
+
+        for (i32 k = 0; k < batch_count; k++) {
+            if ((i64)fwrite(out_mem.data() + k * frame_capacity, 1, out_size[k], file) != out_size[k]) {
+                LOG_ERROR("Could not write trajectory to file '%.*s'", (int)filename.length(), filename.beg());
+                return false;
+            }
+            if (frame_bytes) frame_bytes[batch_beg + k] = {(u64)offset, (u64)out_size[k]};
+            offset += out_size[k];
+        }
+    }
+
+    return true;
+}
+
+bool init_trajectory_stream(MoleculeTrajectory* traj, CStringView filename, i32 window_size) {
+    ASSERT(traj);
+    free_trajectory(traj);
+
+    StringBuffer<512> zfilename = filename;  // Make sure it is zero terminated
+    i32 num_atoms = 0;
+    if (read_xtc_natoms(zfilename.cstr(), &num_atoms) != exdrOK || num_atoms == 0) {
+        LOG_ERROR("Could not read number of atoms in trajectory");
+        return false;
+    }
+
+    i32 num_frames = 0;
+    if (!read_trajectory_num_frames(&num_frames, filename) || num_frames == 0) {
+        LOG_ERROR("Could not read number of frames in trajectory");
+        return false;
+    }
+
+    FrameBytes* frame_bytes = (FrameBytes*)TMP_MALLOC(num_frames * sizeof(FrameBytes));
+    defer { TMP_FREE(frame_bytes); };
+    if (!read_trajectory_frame_bytes(frame_bytes, filename)) {
+        LOG_ERROR("Could not read frame offsets in trajectory");
+        return false;
+    }
+
+    return ::init_trajectory_stream(traj, num_atoms, num_frames, frame_bytes, filename, decompress_trajectory_frame, window_size);
+}
+
+bool init_trajectory_stream(MoleculeTrajectory* traj, Array<const CStringView> filenames, i32 window_size) {
+    ASSERT(traj);
+    free_trajectory(traj);
+
+    const i32 num_parts = (i32)filenames.size();
+    if (num_parts == 0) {
+        LOG_ERROR("No trajectory files supplied");
+        return false;
+    }
+
+    DynamicArray<TrajectoryStreamPart> parts(num_parts, TrajectoryStreamPart());
+    DynamicArray<i32> part_offset(num_parts, 0);  // Offset of the frame bytes of each part within frame_bytes
+    DynamicArray<FrameBytes> frame_bytes;
+    i32 num_atoms = 0;
+
+    for (i32 i = 0; i < num_parts; i++) {
+        const CStringView filename = filenames[i];
+        StringBuffer<512> zfilename = filename;  // Make sure it is zero terminated
+        i32 part_atoms = 0;
+        if (read_xtc_natoms(zfilename.cstr(), &part_atoms) != exdrOK || part_atoms == 0) {
+            LOG_ERROR("Could not read number of atoms in trajectory '%.*s'", (int)filename.length(), filename.beg());
+            return false;
+        }
+        if (i > 0 && part_atoms != num_atoms) {
+            LOG_ERROR("Number of atoms in trajectory '%.*s' does not match the previous parts", (int)filename.length(), filename.beg());
+            return false;
+        }
+        num_atoms = part_atoms;
+
+        i32 num_frames = 0;
+        if (!read_trajectory_num_frames(&num_frames, filename) || num_frames == 0) {
+            LOG_ERROR("Could not read number of frames in trajectory '%.*s'", (int)filename.length(), filename.beg());
+            return false;
+        }
+        part_offset[i] = (i32)frame_bytes.size();
+        frame_bytes.resize(frame_bytes.size() + num_frames);
+        if (!read_trajectory_frame_bytes(frame_bytes.data() + part_offset[i], filename)) {
+            LOG_ERROR("Could not read frame offsets in trajectory '%.*s'", (int)filename.length(), filename.beg());
+            return false;
+        }
+        parts[i].filename = filename;
+        parts[i].frame_range = {0, num_frames};
+    }
+
+    for (i32 i = 0; i < num_parts; i++) {
+        parts[i].frame_bytes = frame_bytes.data() + part_offset[i];
+    }
+
+    // A continued run starts with the frame of its checkpoint, which is already the last frame of the previous part.
+    // Leading frames which are not later in time than the end of the previous part are dropped.
+    f32 last_time = 0;
+    for (i32 i = 0; i < num_parts; i++) {
+        FILE* file = fopen(parts[i].filename, "rb");
+        if (!file) {
+            LOG_ERROR("Could not open file '%.*s'", (int)parts[i].filename.length(), parts[i].filename.beg());
+            return false;
+        }
+        defer { fclose(file); };
+
+        Range<i32>& range = parts[i].frame_range;
+        if (i > 0) {
+            f32 time = 0;
+            while (range.beg < range.end) {
+                if (!read_frame_time(&time, file, parts[i].frame_bytes[range.beg])) {
+                    LOG_ERROR("Could not read time of frame %i from trajectory", range.beg);
+                    return false;
+                }
+                if (time > last_time) break;
+                range.beg++;
+            }
+            if (range.beg > 0) {
+                LOG_NOTE("Dropped %i frame(s) at the start of '%.*s' which overlap the previous part", range.beg, (int)parts[i].filename.length(),
+                         parts[i].filename.beg());
+            }
+        }
+        if (range.beg < range.end && !read_frame_time(&last_time, file, parts[i].frame_bytes[range.end - 1])) {
+            LOG_ERROR("Could not read time of frame %i from trajectory", range.end - 1);
+            return false;
+        }
+    }
+
+    return ::init_trajectory_stream(traj, num_atoms, {parts.data(), parts.size()}, decompress_trajectory_frame, window_size);
+}
+
 }  // namespace xtc
\ No newline at end of file
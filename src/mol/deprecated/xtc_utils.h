@@ -6,6 +6,26 @@
 namespace xtc {
 
 // Helper functions
+// Loads entire trajectory, decompressing frames concurrently on num_threads threads (<= 0 uses all hardware threads)
+bool load_trajectory_from_file(MoleculeTrajectory* traj, CStringView filename, i32 num_threads = 0, TrajectoryLoadStats* stats = nullptr);
+// Loads only the frames selected by the load options, skipped frames are never decompressed and no memory is allocated for them.
+// If the options hold an atom mask, only the positions of the selected atoms are stored (see set_trajectory_atom_subset).
+bool load_trajectory_from_file(MoleculeTrajectory* traj, CStringView filename, const TrajectoryLoadOptions& opt, i32 num_threads = 0,
+                               TrajectoryLoadStats* stats = nullptr);
+// Same as load_trajectory_from_file, but stores the positions quantized to 16-bit (see init_trajectory_quantized)
+bool load_trajectory_from_file_quantized(MoleculeTrajectory* traj, CStringView filename, i32 window_size, i32 num_threads = 0,
+                                         TrajectoryLoadStats* stats = nullptr);
+
+// Same as load_trajectory_from_file, but reloads instantly from a memory mapped binary cache (.mdtc) next to the trajectory if it is valid.
+// If the binary cache is missing or stale, the trajectory is decoded and the binary cache is (re)written.
+bool load_trajectory_from_file_with_binary_cache(MoleculeTrajectory* traj, CStringView filename, i32 num_threads = 0, TrajectoryLoadStats* stats = nullptr);
+// Extends the trajectory with the frames which have been appended to the file since it was loaded, e.g. when following a running simulation.
+// Only the new tail of the file is indexed and decompressed.
+bool update_trajectory(MoleculeTrajectory* traj, CStringView filename, i32 num_threads = 0);
+// Writes all frames of the trajectory to an xtc file. Frames are compressed concurrently on num_threads threads (<= 0 uses all hardware threads)
+// and written in order. If frame_bytes is supplied (num_frames entries), it receives the byte range of each frame within the written file.
+// Streamed trajectories are fetched frame by frame, so they can be written without being resident.
+bool write_trajectory(MoleculeTrajectory& traj, CStringView filename, FrameBytes* frame_bytes = nullptr, i32 num_threads = 0, f32 precision = 1000.0f);
 bool read_trajectory_frames_from_file(Array<TrajectoryFrame> frames, Array<const i64> frame_file_offsets, i32 num_atoms, CStringView filename);
 
 // --- Core functionality ---
@@ -13,4 +33,18 @@ bool read_trajectory_num_frames(i32* num_frames, CStringView filename);
 bool read_trajectory_frame_bytes(FrameBytes* frame_bytes, CStringView filename);
 bool decompress_trajectory_frame(TrajectoryFrame* frame, i32 num_atoms, Array<u8> raw_data);
 
+// Reads and decompresses the frames within frame_range concurrently into traj->frame_buffer, which must already be allocated (init_trajectory or init_trajectory_quantized).
+// frame_bytes holds the byte offsets of all frames in the file (read_trajectory_frame_bytes).
+// num_threads <= 0 uses one thread per hardware thread, stats is optional.
+bool read_trajectory_frames(MoleculeTrajectory* traj, Range<i32> frame_range, const FrameBytes* frame_bytes, CStringView filename, i32 num_threads = 0,
+                            TrajectoryLoadStats* stats = nullptr);
+
+// Initializes a streamed trajectory where only window_size frames are resident in memory and frames are decompressed on demand
+bool init_trajectory_stream(MoleculeTrajectory* traj, CStringView filename, i32 window_size);
+
+// Streams a trajectory which is split over several files (e.g. traj.part0001.xtc, traj.part0002.xtc, ...) as one trajectory, the files are given in order.
+// Frames at the start of a part which are not later in time than the last frame of the previous part are dropped (duplicate boundary frames).
+// Only the frame byte ranges of the files are combined, every frame is read from the file which holds it.
+bool init_trajectory_stream(MoleculeTrajectory* traj, Array<const CStringView> filenames, i32 window_size);
+
 }
\ No newline at end of file
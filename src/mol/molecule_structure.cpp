@@ -135,7 +135,7 @@ inline const char* instert_pool(strpool_t* pool, CStringView str) {
     return strpool_cstr(pool, strpool_inject(pool, str.cstr(), str.length()));
 }
 
-bool init_molecule_structure(MoleculeStructure* mol, const MoleculeStructureDescriptor& desc) {
+bool allocate_molecule_structure(MoleculeStructure* mol, i64 num_atoms, i64 num_residues) {
     ASSERT(mol);
     free_molecule_structure(mol);
 
@@ -143,21 +143,21 @@ bool init_molecule_structure(MoleculeStructure* mol, const MoleculeStructureDesc
     strpool_t* pool = (strpool_t*)mol->internal.strpool;
     strpool_init(pool, &strpool_default_config);
 
-    if (desc.num_atoms > 0) {
+    if (num_atoms > 0) {
         // Allocate Aligned data (@NOTE: Is perhaps not necessary as trajectory data is not aligned anyways...)
-        const i64 aligned_size = (desc.num_atoms * sizeof(float) + ALIGNMENT) * 5;
+        const i64 aligned_size = (num_atoms * sizeof(float) + ALIGNMENT) * 5;
         void* aligned_mem = ALIGNED_MALLOC(aligned_size, ALIGNMENT);
         if (!aligned_mem) return false;
         memset(aligned_mem, 0, aligned_size);
 
-        mol->atom.count = desc.num_atoms;
+        mol->atom.count = num_atoms;
         mol->atom.position.x = (float*)aligned_mem;
-        mol->atom.position.y = (float*)get_next_aligned_adress(mol->atom.position.x + desc.num_atoms, ALIGNMENT);
-        mol->atom.position.z = (float*)get_next_aligned_adress(mol->atom.position.y + desc.num_atoms, ALIGNMENT);
-        mol->atom.radius = (float*)get_next_aligned_adress(mol->atom.position.z + desc.num_atoms, ALIGNMENT);
-        mol->atom.mass = (float*)get_next_aligned_adress(mol->atom.radius + desc.num_atoms, ALIGNMENT);
+        mol->atom.position.y = (float*)get_next_aligned_adress(mol->atom.position.x + num_atoms, ALIGNMENT);
+        mol->atom.position.z = (float*)get_next_aligned_adress(mol->atom.position.y + num_atoms, ALIGNMENT);
+        mol->atom.radius = (float*)get_next_aligned_adress(mol->atom.position.z + num_atoms, ALIGNMENT);
+        mol->atom.mass = (float*)get_next_aligned_adress(mol->atom.radius + num_atoms, ALIGNMENT);
 
-        const i64 other_size = desc.num_atoms * (sizeof(Element) + sizeof(const char*) + sizeof(ResIdx) + sizeof(ChainIdx) + sizeof(AtomFlags));
+        const i64 other_size = num_atoms * (sizeof(Element) + sizeof(const char*) + sizeof(ResIdx) + sizeof(ChainIdx) + sizeof(AtomFlags));
         void* other_mem = MALLOC(other_size);
         if (!other_mem) return false;
         memset(other_mem, 0, other_size);
@@ -167,48 +167,69 @@ bool init_molecule_structure(MoleculeStructure* mol, const MoleculeStructureDesc
         mol->atom.res_idx = (ResIdx*)(mol->atom.name + mol->atom.count);
         mol->atom.chain_idx = (ChainIdx*)(mol->atom.res_idx + mol->atom.count);
         mol->atom.flags = (AtomFlags*)(mol->atom.chain_idx + mol->atom.count);
-
-        if (desc.atoms) {
-            for (int i = 0; i < desc.num_atoms; i++) {
-                mol->atom.position.x[i] = desc.atoms[i].x;
-                mol->atom.position.y[i] = desc.atoms[i].y;
-                mol->atom.position.z[i] = desc.atoms[i].z;
-
-                mol->atom.element[i] = desc.atoms[i].element;
-                if (mol->atom.element[i] == Element::Unknown) {
-                    mol->atom.element[i] = get_element_from_string(desc.atoms[i].name);
-                }
-
-                mol->atom.radius[i] = element::vdw_radius(mol->atom.element[i]);
-                mol->atom.mass[i] = element::atomic_mass(mol->atom.element[i]);
-                mol->atom.name[i] = instert_pool(pool, desc.atoms[i].name);
-                mol->atom.res_idx[i] = desc.atoms[i].residue_index;
-                mol->atom.chain_idx[i] = INVALID_CHAIN_IDX;
-            }
-        }
     }
 
-    if (desc.num_residues > 0) {
-        const i64 mem_size = desc.num_residues * (sizeof(ResIdx) + sizeof(const char*) + sizeof(AtomRange) + 2 * sizeof(BondRange));
+    if (num_residues > 0) {
+        const i64 mem_size = num_residues * (sizeof(ResIdx) + sizeof(const char*) + sizeof(AtomRange) + 2 * sizeof(BondRange));
         void* mem = MALLOC(mem_size);
         if (!mem) return false;
         memset(mem, 0, mem_size);
 
-        mol->residue.count = desc.num_residues;
+        mol->residue.count = num_residues;
         mol->residue.id = (ResIdx*)mem;
-        mol->residue.name = (const char**)(mol->residue.id + desc.num_residues);
-        mol->residue.atom_range = (AtomRange*)(mol->residue.name + desc.num_residues);
-        mol->residue.bond.complete = (BondRange*)(mol->residue.atom_range + desc.num_residues);
-        mol->residue.bond.intra = (BondRange*)(mol->residue.bond.complete + desc.num_residues);
-        if (desc.residues) {
-            for (i32 i = 0; i < desc.num_residues; i++) {
-                mol->residue.id[i] = desc.residues[i].id;
-                mol->residue.name[i] = instert_pool(pool, desc.residues[i].name);
-                mol->residue.atom_range[i] = desc.residues[i].atom_range;
-                // bond
-            }
+        mol->residue.name = (const char**)(mol->residue.id + num_residues);
+        mol->residue.atom_range = (AtomRange*)(mol->residue.name + num_residues);
+        mol->residue.bond.complete = (BondRange*)(mol->residue.atom_range + num_residues);
+        mol->residue.bond.intra = (BondRange*)(mol->residue.bond.complete + num_residues);
+    }
+
+    return true;
+}
+
+void set_molecule_structure_atoms(MoleculeStructure* mol, i64 offset, const AtomDescriptor* atoms, i64 count) {
+    ASSERT(mol);
+    ASSERT(atoms);
+    ASSERT(0 <= offset && offset + count <= mol->atom.count);
+    strpool_t* pool = (strpool_t*)mol->internal.strpool;
+
+    for (i64 j = 0; j < count; j++) {
+        const i64 i = offset + j;
+        mol->atom.position.x[i] = atoms[j].x;
+        mol->atom.position.y[i] = atoms[j].y;
+        mol->atom.position.z[i] = atoms[j].z;
+
+        mol->atom.element[i] = atoms[j].element;
+        if (mol->atom.element[i] == Element::Unknown) {
+            mol->atom.element[i] = get_element_from_string(atoms[j].name);
         }
+
+        mol->atom.radius[i] = element::vdw_radius(mol->atom.element[i]);
+        mol->atom.mass[i] = element::atomic_mass(mol->atom.element[i]);
+        mol->atom.name[i] = instert_pool(pool, atoms[j].name);
+        mol->atom.res_idx[i] = atoms[j].residue_index;
+        mol->atom.chain_idx[i] = INVALID_CHAIN_IDX;
+    }
+}
+
+void set_molecule_structure_residues(MoleculeStructure* mol, i64 offset, const ResidueDescriptor* residues, i64 count) {
+    ASSERT(mol);
+    ASSERT(residues);
+    ASSERT(0 <= offset && offset + count <= mol->residue.count);
+    strpool_t* pool = (strpool_t*)mol->internal.strpool;
+
+    for (i64 j = 0; j < count; j++) {
+        const i64 i = offset + j;
+        mol->residue.id[i] = residues[j].id;
+        mol->residue.name[i] = instert_pool(pool, residues[j].name);
+        mol->residue.atom_range[i] = residues[j].atom_range;
+        // bond
     }
+}
+
+bool finalize_molecule_structure(MoleculeStructure* mol, const ChainDescriptor* chains, i64 num_chains, const SecondaryStructureDescriptor* secondary_structures,
+                                 i64 num_secondary_structures) {
+    ASSERT(mol);
+    strpool_t* pool = (strpool_t*)mol->internal.strpool;
 
     // We ignore bonds for now and compute our own
     {
@@ -218,22 +239,22 @@ bool init_molecule_structure(MoleculeStructure* mol, const MoleculeStructureDesc
         mol->covalent_bond.count = bonds.size();
     }
 
-    if (desc.num_chains > 0) {
-        const i64 mem_size = desc.num_chains * (sizeof(const char*) + sizeof(AtomRange) + sizeof(ResRange));
+    if (num_chains > 0) {
+        const i64 mem_size = num_chains * (sizeof(const char*) + sizeof(AtomRange) + sizeof(ResRange));
         void* mem = MALLOC(mem_size);
         memset(mem, 0, mem_size);
 
-        mol->chain.count = desc.num_chains;
+        mol->chain.count = num_chains;
         mol->chain.id = (const char**)mem;
         mol->chain.atom_range = (AtomRange*)(mol->chain.id + mol->chain.count);
         mol->chain.residue_range = (ResRange*)(mol->chain.atom_range + mol->chain.count);
-        if (desc.chains) {
-            for (i32 i = 0; i < desc.num_chains; i++) {
-                mol->chain.id[i] = instert_pool(pool, desc.chains[i].id);
-                mol->chain.residue_range[i] = desc.chains[i].residue_range;
+        if (chains) {
+            for (i32 i = 0; i < num_chains; i++) {
+                mol->chain.id[i] = instert_pool(pool, chains[i].id);
+                mol->chain.residue_range[i] = chains[i].residue_range;
             }
         }
-    } else if (desc.num_residues > 0 && desc.residues) {
+    } else if (mol->residue.count > 0) {
         // Generate artificial chains for every connected sequence of protein residues, ignore single residues e.g ext() == 1
         DynamicArray<ResRange> seq;
         ResRange range{0, 1};
@@ -305,10 +326,10 @@ bool init_molecule_structure(MoleculeStructure* mol, const MoleculeStructureDesc
         }
     }
 
-    if (desc.num_secondary_structures > 0 && mol->residue.backbone.secondary_structure) {
-        for (i64 i = 0; i < desc.num_secondary_structures; ++i) {
-            for (i64 ri = desc.secondary_structures[i].residue_range.beg; ri < desc.secondary_structures[i].residue_range.end; ++ri) {
-                mol->residue.backbone.secondary_structure[ri] = desc.secondary_structures[i].type;
+    if (num_secondary_structures > 0 && mol->residue.backbone.secondary_structure) {
+        for (i64 i = 0; i < num_secondary_structures; ++i) {
+            for (i64 ri = secondary_structures[i].residue_range.beg; ri < secondary_structures[i].residue_range.end; ++ri) {
+                mol->residue.backbone.secondary_structure[ri] = secondary_structures[i].type;
             }
         }
     }
@@ -329,6 +350,14 @@ bool init_molecule_structure(MoleculeStructure* mol, const MoleculeStructureDesc
     return true;
 }
 
+bool init_molecule_structure(MoleculeStructure* mol, const MoleculeStructureDescriptor& desc) {
+    ASSERT(mol);
+    if (!allocate_molecule_structure(mol, desc.num_atoms, desc.num_residues)) return false;
+    if (desc.atoms) set_molecule_structure_atoms(mol, 0, desc.atoms, desc.num_atoms);
+    if (desc.residues) set_molecule_structure_residues(mol, 0, desc.residues, desc.num_residues);
+    return finalize_molecule_structure(mol, desc.chains, desc.num_chains, desc.secondary_structures, desc.num_secondary_structures);
+}
+
 void free_molecule_structure(MoleculeStructure* mol) {
     ASSERT(mol);
     if (mol->atom.position.x) ALIGNED_FREE(mol->atom.position.x);
@@ -287,4 +287,14 @@ struct MoleculeStructureDescriptor {
 };
 
 bool init_molecule_structure(MoleculeStructure* mol, const MoleculeStructureDescriptor& desc);
+
+// Incremental initialization, for loaders which stream their source and never hold all descriptors in memory at once.
+// init_molecule_structure is equivalent to allocate -> set atoms and residues -> finalize.
+// Strings referenced by the descriptors are copied when set, so their source only has to outlive the call.
+bool allocate_molecule_structure(MoleculeStructure* mol, i64 num_atoms, i64 num_residues);
+void set_molecule_structure_atoms(MoleculeStructure* mol, i64 offset, const AtomDescriptor* atoms, i64 count);
+void set_molecule_structure_residues(MoleculeStructure* mol, i64 offset, const ResidueDescriptor* residues, i64 count);
+// Computes bonds, chains (generated from connected residues if no chains are given) and backbones once all atoms and residues are set
+bool finalize_molecule_structure(MoleculeStructure* mol, const ChainDescriptor* chains, i64 num_chains,
+                                 const SecondaryStructureDescriptor* secondary_structures, i64 num_secondary_structures);
 void free_molecule_structure(MoleculeStructure* mol);
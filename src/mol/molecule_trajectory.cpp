@@ -1,7 +1,10 @@
 #include "molecule_trajectory.h"
 #include <core/log.h>
+#include <core/file.h>
 //#include <core/hash.h>
-//#include <mol/trajectory_utils.h>
+#include <mol/trajectory_utils.h>
+#include <mol/molecule_utils.h>
+#include <mol/trajectory_prefetch.h>
 
 #define ALIGNMENT 64
 
@@ -51,17 +54,525 @@ bool init_trajectory(MoleculeTrajectory* traj, i32 num_atoms, i32 num_frames, f3
         traj->frame_buffer[i].atom_position.x = traj->position_data.x + i * num_atoms;
         traj->frame_buffer[i].atom_position.y = traj->position_data.y + i * num_atoms;
         traj->frame_buffer[i].atom_position.z = traj->position_data.z + i * num_atoms;
+        traj->frame_buffer[i].velocity = {};
+        traj->frame_buffer[i].force = {};
     }
 
     return true;
 }
 
+// Initializes a trajectory where only window_size frames have resident position data.
+// The slot bookkeeping is allocated together with extra_mem_size additional bytes, which are returned through extra_mem.
+static bool init_trajectory_window(MoleculeTrajectory* traj, i32 num_atoms, i32 num_frames, i32 window_size, f32 time_between_frames, const mat3& sim_box,
+                                   i64 extra_mem_size, void** extra_mem) {
+    // The position memory only covers the window of resident frames, so we initialize a regular trajectory with window_size frames
+    // and then extend the frame_buffer to hold the meta data (index, time, box) of all frames.
+    if (!init_trajectory(traj, num_atoms, window_size, time_between_frames, sim_box)) {
+        return false;
+    }
+
+    TrajectoryFrame* frame_mem = (TrajectoryFrame*)REALLOC(traj->frame_buffer.ptr, num_frames * sizeof(TrajectoryFrame));
+    if (!frame_mem) {
+        LOG_ERROR("Could not allocate memory for trajectory frames");
+        free_trajectory(traj);
+        return false;
+    }
+    traj->num_frames = num_frames;
+    traj->frame_buffer = {frame_mem, num_frames};
+
+    for (i32 i = 0; i < num_frames; i++) {
+        traj->frame_buffer[i].index = i;
+        traj->frame_buffer[i].time = i * time_between_frames;
+        traj->frame_buffer[i].box = sim_box;
+        traj->frame_buffer[i].atom_position = {};
+        traj->frame_buffer[i].velocity = {};
+        traj->frame_buffer[i].force = {};
+    }
+
+    void* slot_mem = MALLOC(window_size * (sizeof(u64) + sizeof(i32)) + extra_mem_size);
+    if (!slot_mem) {
+        LOG_ERROR("Could not allocate memory for trajectory window");
+        free_trajectory(traj);
+        return false;
+    }
+
+    auto& stream = traj->stream;
+    stream.slot_tick = (u64*)slot_mem;
+    stream.slot_frame = (i32*)(stream.slot_tick + window_size);
+    stream.num_slots = window_size;
+    stream.tick = 0;
+    for (i32 i = 0; i < window_size; i++) {
+        stream.slot_frame[i] = -1;
+        stream.slot_tick[i] = 0;
+    }
+
+    if (extra_mem) *extra_mem = stream.slot_frame + window_size;
+    return true;
+}
+
+bool init_trajectory_stream(MoleculeTrajectory* traj, i32 num_atoms, i32 num_frames, const FrameBytes* frame_bytes, CStringView filename,
+                            ExtractFrameFunc extract_frame, i32 window_size, f32 time_between_frames, const mat3& sim_box) {
+    TrajectoryStreamPart part;
+    part.filename = filename;
+    part.frame_bytes = frame_bytes;
+    part.frame_range = {0, num_frames};
+    return init_trajectory_stream(traj, num_atoms, {&part, 1}, extract_frame, window_size, time_between_frames, sim_box);
+}
+
+bool init_trajectory_stream(MoleculeTrajectory* traj, i32 num_atoms, Array<const TrajectoryStreamPart> parts, ExtractFrameFunc extract_frame,
+                            i32 window_size, f32 time_between_frames, const mat3& sim_box) {
+    ASSERT(traj);
+    ASSERT(extract_frame);
+
+    const i32 num_parts = (i32)parts.size();
+    i32 num_frames = 0;
+    u64 max_extent = 0;
+    for (const auto& part : parts) {
+        ASSERT(part.frame_bytes);
+        for (i32 i = part.frame_range.beg; i < part.frame_range.end; i++) {
+            if (part.frame_bytes[i].extent > max_extent) max_extent = part.frame_bytes[i].extent;
+        }
+        num_frames += part.frame_range.end - part.frame_range.beg;
+    }
+
+    if (window_size <= 0 || num_frames <= 0) {
+        LOG_ERROR("Invalid window size or number of frames for trajectory stream");
+        return false;
+    }
+    if (window_size > num_frames) window_size = num_frames;
+
+    FILE** part_file = (FILE**)MALLOC(num_parts * (sizeof(FILE*) + sizeof(i32)));
+    if (!part_file) {
+        LOG_ERROR("Could not allocate memory for trajectory stream parts");
+        return false;
+    }
+    i32* part_frame_beg = (i32*)(part_file + num_parts);
+
+    for (i32 i = 0; i < num_parts; i++) {
+        const CStringView filename = parts[i].filename;
+        part_file[i] = fopen(filename, "rb");
+        if (!part_file[i]) {
+            LOG_ERROR("Could not open file '%.*s'", (int)filename.length(), filename.beg());
+            for (i32 j = 0; j < i; j++) fclose(part_file[j]);
+            FREE(part_file);
+            return false;
+        }
+    }
+
+    void* extra_mem = nullptr;
+    if (!init_trajectory_window(traj, num_atoms, num_frames, window_size, time_between_frames, sim_box, num_frames * sizeof(FrameBytes) + max_extent,
+                                &extra_mem)) {
+        for (i32 i = 0; i < num_parts; i++) fclose(part_file[i]);
+        FREE(part_file);
+        return false;
+    }
+
+    auto& stream = traj->stream;
+    stream.file = part_file[0];
+    stream.num_parts = num_parts;
+    stream.part_file = part_file;
+    stream.part_frame_beg = part_frame_beg;
+    stream.extract_frame = extract_frame;
+    stream.frame_bytes = (FrameBytes*)extra_mem;
+    stream.read_buffer = {(u8*)(stream.frame_bytes + num_frames), (i64)max_extent};
+
+    // @NOTE: The byte ranges remain relative to the file of each part
+    i32 frame_beg = 0;
+    for (i32 i = 0; i < num_parts; i++) {
+        const Range<i32> range = parts[i].frame_range;
+        part_frame_beg[i] = frame_beg;
+        memcpy(stream.frame_bytes + frame_beg, parts[i].frame_bytes + range.beg, (range.end - range.beg) * sizeof(FrameBytes));
+        frame_beg += range.end - range.beg;
+    }
+
+    return true;
+}
+
+FILE* get_trajectory_frame_file(const MoleculeTrajectory& traj, i32 frame_index) {
+    const auto& stream = traj.stream;
+    if (stream.num_parts <= 1) return stream.file;
+
+    // Last part which begins at or before the frame
+    i32 lo = 0;
+    i32 hi = stream.num_parts - 1;
+    while (lo < hi) {
+        const i32 mid = (lo + hi + 1) / 2;
+        if (stream.part_frame_beg[mid] <= frame_index) lo = mid;
+        else hi = mid - 1;
+    }
+    return stream.part_file[lo];
+}
+
+bool init_trajectory_quantized(MoleculeTrajectory* traj, i32 num_atoms, i32 num_frames, i32 window_size, f32 time_between_frames, const mat3& sim_box) {
+    ASSERT(traj);
+
+    if (window_size <= 0 || num_frames <= 0) {
+        LOG_ERROR("Invalid window size or number of frames for quantized trajectory");
+        return false;
+    }
+    if (window_size > num_frames) window_size = num_frames;
+
+    void* extra_mem = nullptr;
+    if (!init_trajectory_window(traj, num_atoms, num_frames, window_size, time_between_frames, sim_box, num_frames * sizeof(vec3) * 2, &extra_mem)) {
+        return false;
+    }
+
+    u16* data = (u16*)ALIGNED_MALLOC((i64)num_frames * num_atoms * 3 * sizeof(u16), ALIGNMENT);
+    if (!data) {
+        LOG_ERROR("Could not allocate memory for quantized trajectory positions");
+        free_trajectory(traj);
+        return false;
+    }
+
+    traj->quantized.data = data;
+    traj->quantized.scale = (vec3*)extra_mem;
+    traj->quantized.offset = traj->quantized.scale + num_frames;
+    for (i32 i = 0; i < num_frames; i++) {
+        traj->quantized.scale[i] = {};
+        traj->quantized.offset[i] = {};
+    }
+
+    return true;
+}
+
+void store_trajectory_frame_quantized(MoleculeTrajectory* traj, i32 frame_index, const soa_vec3 positions) {
+    ASSERT(traj);
+    ASSERT(is_trajectory_quantized(*traj));
+    ASSERT(0 <= frame_index && frame_index < traj->num_frames);
+
+    const i64 num_atoms = traj->num_atoms;
+    const AABB aabb = compute_aabb(positions, num_atoms);
+    const vec3 scale = aabb.ext() / 65535.0f;
+
+    u16* q = traj->quantized.data + frame_index * num_atoms * 3;
+    quantize(q, q + num_atoms, q + num_atoms * 2, positions, num_atoms, scale, aabb.min);
+    traj->quantized.scale[frame_index] = scale;
+    traj->quantized.offset[frame_index] = aabb.min;
+
+    // Invalidate the resident copy, it will be dequantized again on the next fetch
+    TrajectoryFrame& frame = traj->frame_buffer[frame_index];
+    if (frame.atom_position.x) {
+        const i64 slot = (frame.atom_position.x - traj->position_data.x) / num_atoms;
+        traj->stream.slot_frame[slot] = -1;
+        traj->stream.slot_tick[slot] = 0;
+        frame.atom_position = {};
+    }
+}
+
+// Reallocates the slot bookkeeping of a windowed trajectory with room for new_extra_mem_size additional bytes, the previous extra bytes are not kept
+static void* grow_trajectory_window(MoleculeTrajectory* traj, i64 new_extra_mem_size) {
+    auto& stream = traj->stream;
+    const i64 slot_mem_size = stream.num_slots * (sizeof(u64) + sizeof(i32));
+    void* slot_mem = MALLOC(slot_mem_size + new_extra_mem_size);
+    if (!slot_mem) {
+        LOG_ERROR("Could not allocate memory for trajectory window");
+        return nullptr;
+    }
+    memcpy(slot_mem, stream.slot_tick, slot_mem_size);
+    stream.slot_tick = (u64*)slot_mem;
+    stream.slot_frame = (i32*)(stream.slot_tick + stream.num_slots);
+    return stream.slot_frame + stream.num_slots;
+}
+
+// Allocates three 64-byte aligned planes of count floats within a single allocation, zero initialized
+static bool allocate_planes(soa_vec3* data, i64 count) {
+    const i64 mem_size = (count * (i64)sizeof(float) + ALIGNMENT) * 3;
+    void* mem = ALIGNED_MALLOC(mem_size, ALIGNMENT);
+    if (!mem) return false;
+    memset(mem, 0, mem_size);
+    data->x = (float*)mem;
+    data->y = (float*)get_next_aligned_adress(data->x + count, ALIGNMENT);
+    data->z = (float*)get_next_aligned_adress(data->y + count, ALIGNMENT);
+    return true;
+}
+
+// Reallocates an optional channel (velocity or force) for new_num_frames and points the frames into it, does nothing if the channel is absent
+static bool grow_channel(MoleculeTrajectory* traj, soa_vec3 TrajectoryFrame::*channel, soa_vec3* data, i32 old_num_frames, i32 new_num_frames) {
+    if (!data->x) return true;
+    const i32 num_atoms = traj->num_atoms;
+
+    soa_vec3 new_data;
+    if (!allocate_planes(&new_data, (i64)new_num_frames * num_atoms)) {
+        LOG_ERROR("Could not allocate memory for trajectory channel");
+        return false;
+    }
+    const i64 old_size = (i64)old_num_frames * num_atoms * sizeof(float);
+    memcpy(new_data.x, data->x, old_size);
+    memcpy(new_data.y, data->y, old_size);
+    memcpy(new_data.z, data->z, old_size);
+    ALIGNED_FREE(data->x);
+
+    *data = new_data;
+    for (i32 i = 0; i < new_num_frames; i++) {
+        traj->frame_buffer[i].*channel = new_data + (i64)i * num_atoms;
+    }
+    return true;
+}
+
+bool init_trajectory_channels(MoleculeTrajectory* traj, u32 channels) {
+    ASSERT(traj);
+    if (is_trajectory_streamed(*traj) || traj->mapped_file) {
+        LOG_ERROR("Trajectory channels require a resident trajectory");
+        return false;
+    }
+
+    const i32 num_atoms = traj->num_atoms;
+    const i32 num_frames = traj->num_frames;
+    const struct {
+        TrajectoryChannel flag;
+        soa_vec3 TrajectoryFrame::*channel;
+        soa_vec3* data;
+    } entries[] = {
+        {TrajectoryChannel_Velocity, &TrajectoryFrame::velocity, &traj->velocity_data},
+        {TrajectoryChannel_Force, &TrajectoryFrame::force, &traj->force_data},
+    };
+
+    for (const auto& e : entries) {
+        if (!(channels & e.flag) || e.data->x) continue;
+        if (!allocate_planes(e.data, (i64)num_frames * num_atoms)) {
+            LOG_ERROR("Could not allocate memory for trajectory channel");
+            return false;
+        }
+        for (i32 i = 0; i < num_frames; i++) {
+            traj->frame_buffer[i].*e.channel = *e.data + (i64)i * num_atoms;
+        }
+    }
+    return true;
+}
+
+bool grow_trajectory(MoleculeTrajectory* traj, i32 new_num_frames, const FrameBytes* frame_bytes) {
+    ASSERT(traj);
+    ASSERT(new_num_frames >= traj->num_frames);
+
+    const i32 num_atoms = traj->num_atoms;
+    const i32 old_num_frames = traj->num_frames;
+    if (new_num_frames == old_num_frames) return true;
+
+    if (traj->mapped_file) {
+        LOG_ERROR("Trajectories backed by a binary cache cannot grow");
+        return false;
+    }
+
+    const bool streamed_from_file = is_trajectory_streamed(*traj) && !is_trajectory_quantized(*traj);
+    if (streamed_from_file && !frame_bytes) {
+        LOG_ERROR("Streamed trajectories require the frame bytes of the new frames in order to grow");
+        return false;
+    }
+
+    // The prefetcher reads the frame bytes concurrently, so it is paused while the trajectory grows
+    const i32 prefetch_ring_size = get_trajectory_prefetch_ring_size(*traj);
+    if (prefetch_ring_size > 0) stop_trajectory_prefetch(traj);
+    defer {
+        if (prefetch_ring_size > 0) start_trajectory_prefetch(traj, prefetch_ring_size);
+    };
+
+    TrajectoryFrame* frame_mem = (TrajectoryFrame*)REALLOC(traj->frame_buffer.ptr, new_num_frames * sizeof(TrajectoryFrame));
+    if (!frame_mem) {
+        LOG_ERROR("Could not allocate memory for trajectory frames");
+        return false;
+    }
+    traj->frame_buffer = {frame_mem, new_num_frames};
+
+    const mat3 last_box = old_num_frames > 0 ? traj->frame_buffer[old_num_frames - 1].box : mat3(0);
+    const f32 last_time = old_num_frames > 0 ? traj->frame_buffer[old_num_frames - 1].time : 0.0f;
+    for (i32 i = old_num_frames; i < new_num_frames; i++) {
+        traj->frame_buffer[i].index = i;
+        traj->frame_buffer[i].time = last_time;
+        traj->frame_buffer[i].box = last_box;
+        traj->frame_buffer[i].atom_position = {};
+        traj->frame_buffer[i].velocity = {};
+        traj->frame_buffer[i].force = {};
+    }
+
+    if (is_trajectory_quantized(*traj)) {
+        const i64 data_size = (i64)new_num_frames * num_atoms * 3 * sizeof(u16);
+        u16* data = (u16*)ALIGNED_MALLOC(data_size, ALIGNMENT);
+        vec3* old_scale = traj->quantized.scale;
+        u64* old_slot_mem = traj->stream.slot_tick;
+        void* extra_mem = data ? grow_trajectory_window(traj, new_num_frames * sizeof(vec3) * 2) : nullptr;
+        if (!extra_mem) {
+            if (data) ALIGNED_FREE(data);
+            LOG_ERROR("Could not allocate memory for quantized trajectory positions");
+            return false;
+        }
+        memcpy(data, traj->quantized.data, (i64)old_num_frames * num_atoms * 3 * sizeof(u16));
+        vec3* scale = (vec3*)extra_mem;
+        vec3* offset = scale + new_num_frames;
+        memcpy(scale, old_scale, old_num_frames * sizeof(vec3));
+        memcpy(offset, old_scale + old_num_frames, old_num_frames * sizeof(vec3));
+        for (i32 i = old_num_frames; i < new_num_frames; i++) {
+            scale[i] = {};
+            offset[i] = {};
+        }
+        ALIGNED_FREE(traj->quantized.data);
+        FREE(old_slot_mem);
+        traj->quantized = {data, scale, offset};
+    } else if (streamed_from_file) {
+        u64 max_extent = 0;
+        for (i32 i = 0; i < new_num_frames; i++) {
+            if (frame_bytes[i].extent > max_extent) max_extent = frame_bytes[i].extent;
+        }
+        u64* old_slot_mem = traj->stream.slot_tick;
+        void* extra_mem = grow_trajectory_window(traj, new_num_frames * sizeof(FrameBytes) + max_extent);
+        if (!extra_mem) return false;
+        FREE(old_slot_mem);
+
+        auto& stream = traj->stream;
+        stream.frame_bytes = (FrameBytes*)extra_mem;
+        stream.read_buffer = {(u8*)(stream.frame_bytes + new_num_frames), (i64)max_extent};
+        memcpy(stream.frame_bytes, frame_bytes, new_num_frames * sizeof(FrameBytes));
+    } else {
+        const i64 pos_mem_size = ((i64)new_num_frames * num_atoms * sizeof(float) + ALIGNMENT) * 3;
+        void* pos_mem = ALIGNED_MALLOC(pos_mem_size, ALIGNMENT);
+        if (!pos_mem) {
+            LOG_ERROR("Could not allocate memory for trajectory positions");
+            return false;
+        }
+
+        soa_vec3 pos_data;
+        pos_data.x = (float*)pos_mem;
+        pos_data.y = (float*)get_next_aligned_adress(pos_data.x + (i64)new_num_frames * num_atoms, ALIGNMENT);
+        pos_data.z = (float*)get_next_aligned_adress(pos_data.y + (i64)new_num_frames * num_atoms, ALIGNMENT);
+
+        const i64 old_size = (i64)old_num_frames * num_atoms * sizeof(float);
+        memcpy(pos_data.x, traj->position_data.x, old_size);
+        memcpy(pos_data.y, traj->position_data.y, old_size);
+        memcpy(pos_data.z, traj->position_data.z, old_size);
+        ALIGNED_FREE(traj->position_data.x);
+
+        traj->position_data = pos_data;
+        for (i32 i = 0; i < new_num_frames; i++) {
+            traj->frame_buffer[i].atom_position = pos_data + (i64)i * num_atoms;
+        }
+
+        // The optional channels grow along with the positions, the new frames are zero initialized
+        if (!grow_channel(traj, &TrajectoryFrame::velocity, &traj->velocity_data, old_num_frames, new_num_frames) ||
+            !grow_channel(traj, &TrajectoryFrame::force, &traj->force_data, old_num_frames, new_num_frames)) {
+            return false;
+        }
+    }
+
+    traj->num_frames = new_num_frames;
+    return true;
+}
+
+TrajectoryFrame* fetch_trajectory_frame(MoleculeTrajectory* traj, i32 frame_index) {
+    ASSERT(traj);
+    ASSERT(0 <= frame_index && frame_index < traj->num_frames);
+
+    TrajectoryFrame* frame = traj->frame_buffer.ptr + frame_index;
+    if (!is_trajectory_streamed(*traj)) return frame;
+
+    auto& stream = traj->stream;
+    stream.tick++;
+
+    if (frame->atom_position.x) {
+        // Already resident, the slot is given implicitly by the position pointer
+        const i64 slot = (frame->atom_position.x - traj->position_data.x) / traj->num_atoms;
+        ASSERT(0 <= slot && slot < stream.num_slots);
+        stream.slot_tick[slot] = stream.tick;
+        return frame;
+    }
+
+    // Pick an empty slot or evict the least recently used one
+    i32 slot = 0;
+    for (i32 i = 0; i < stream.num_slots; i++) {
+        if (stream.slot_frame[i] == -1) {
+            slot = i;
+            break;
+        }
+        if (stream.slot_tick[i] < stream.slot_tick[slot]) slot = i;
+    }
+
+    if (stream.slot_frame[slot] != -1) {
+        traj->frame_buffer[stream.slot_frame[slot]].atom_position = {};
+        stream.slot_frame[slot] = -1;
+    }
+
+    frame->atom_position = traj->position_data + (i64)slot * traj->num_atoms;
+
+    if (is_trajectory_quantized(*traj)) {
+        const i64 num_atoms = traj->num_atoms;
+        const u16* q = traj->quantized.data + frame_index * num_atoms * 3;
+        dequantize(frame->atom_position, q, q + num_atoms, q + num_atoms * 2, num_atoms, traj->quantized.scale[frame_index],
+                   traj->quantized.offset[frame_index]);
+    } else if (stream.prefetcher && take_prefetched_frame(stream.prefetcher, frame_index, frame)) {
+        // Prefetch hit, the frame has already been decoded by the read-ahead worker
+    } else {
+        const FrameBytes& bytes = stream.frame_bytes[frame_index];
+        ASSERT((i64)bytes.extent <= stream.read_buffer.size());
+        FILE* file = get_trajectory_frame_file(*traj, frame_index);
+        // @NOTE: Positional read, since the prefetcher may read from the same file concurrently
+        const i64 bytes_read = read_file_at(file, stream.read_buffer.ptr, (i64)bytes.extent, (i64)bytes.offset);
+        if (bytes_read != (i64)bytes.extent) {
+            LOG_ERROR("Could not read frame %i from trajectory stream", frame_index);
+            frame->atom_position = {};
+            return nullptr;
+        }
+
+        if (!stream.extract_frame(frame, traj->num_atoms, {stream.read_buffer.ptr, bytes_read})) {
+            LOG_ERROR("Could not extract frame %i from trajectory stream", frame_index);
+            frame->atom_position = {};
+            return nullptr;
+        }
+        // @NOTE: Some extractors write the simulation step into index, we want it to remain the frame index
+        frame->index = frame_index;
+    }
+
+    stream.slot_frame[slot] = frame_index;
+    stream.slot_tick[slot] = stream.tick;
+
+    return frame;
+}
+
+bool set_trajectory_atom_subset(MoleculeTrajectory* traj, const Bitfield mask) {
+    ASSERT(traj);
+    ASSERT(mask);
+    if (bitfield::number_of_bits_set(mask) != traj->num_atoms) {
+        LOG_ERROR("Atom subset does not match the number of atoms in trajectory");
+        return false;
+    }
+
+    i32* atom_index = (i32*)MALLOC(traj->num_atoms * sizeof(i32));
+    if (!atom_index) {
+        LOG_ERROR("Could not allocate memory for trajectory atom subset");
+        return false;
+    }
+
+    i32 count = 0;
+    for (i64 i = 0; i < mask.size(); i++) {
+        if (bitfield::get_bit(mask, i)) atom_index[count++] = (i32)i;
+    }
+
+    if (traj->subset.atom_index) FREE(traj->subset.atom_index);
+    bitfield::init(&traj->subset.mask, mask);
+    traj->subset.atom_index = atom_index;
+    return true;
+}
+
+void gather_trajectory_atom_subset(const MoleculeTrajectory& traj, soa_vec3 dst, const soa_vec3 src) {
+    ASSERT(is_trajectory_subset(traj));
+    bitfield::gather_masked(dst.x, src.x, traj.subset.mask);
+    bitfield::gather_masked(dst.y, src.y, traj.subset.mask);
+    bitfield::gather_masked(dst.z, src.z, traj.subset.mask);
+}
+
 void free_trajectory(MoleculeTrajectory* traj) {
     ASSERT(traj);
 
     //if (traj->frame_offsets.ptr) FREE(traj->frame_offsets.ptr);
-    if (traj->position_data.x) ALIGNED_FREE(traj->position_data.x);
+    if (traj->stream.prefetcher) stop_trajectory_prefetch(traj);
+    if (traj->mapped_file) unmap_file(&traj->mapped_file);
+    else if (traj->position_data.x) ALIGNED_FREE(traj->position_data.x);
+    if (traj->velocity_data.x) ALIGNED_FREE(traj->velocity_data.x);
+    if (traj->force_data.x) ALIGNED_FREE(traj->force_data.x);
     if (traj->frame_buffer.ptr) FREE(traj->frame_buffer.ptr);
+    for (i32 i = 0; i < traj->stream.num_parts; i++) fclose(traj->stream.part_file[i]);
+    if (traj->stream.part_file) FREE(traj->stream.part_file);
+    if (traj->stream.slot_tick) FREE(traj->stream.slot_tick);
+    if (traj->quantized.data) ALIGNED_FREE(traj->quantized.data);
+    if (traj->subset.atom_index) FREE(traj->subset.atom_index);
+    bitfield::free(&traj->subset.mask);
 
     *traj = {};
 }
@@ -2,8 +2,13 @@
 
 #include <core/types.h>
 #include <core/array_types.h>
+#include <core/string_types.h>
 #include <core/vector_types.h>
 #include <core/common.h>
+#include <core/file.h>
+#include <core/bitfield.h>
+
+#include <stdio.h>
 
 enum class SimulationType {
     Undefined,
@@ -17,22 +22,71 @@ struct TrajectoryFrame {
     f32 time = 0;
     mat3 box = {0, 0, 0, 0, 0, 0, 0, 0, 0};
     soa_vec3 atom_position{};
+
+    // Optional channels (see init_trajectory_channels), nullptr unless the trajectory holds them
+    soa_vec3 velocity{};
+    soa_vec3 force{};
 };
 
+struct FrameBytes;
+struct TrajectoryPrefetcher;
+
+// Extracts the frame data from a raw chunk of bytes read from the trajectory file, e.g. xtc::decompress_trajectory_frame
+typedef bool (*ExtractFrameFunc)(TrajectoryFrame* frame, i32 num_atoms, Array<u8> raw_data);
+
 struct MoleculeTrajectory {
     i32 num_atoms = 0;
     i32 num_frames = 0;
     f32 total_simulation_time = 0;
     SimulationType simulation_type = SimulationType::Undefined;
 
-    // @NOTE: The frame_buffer may not contain all frames in trajectory.
-    // If the trajectory is large, frame_buffer will be used as a cache towards the trajectory streamed from disk.
-    // @NOTE: This is not implemented at the moment.
+    // @NOTE: The frame_buffer may not contain the position data of all frames in trajectory.
+    // If the trajectory is streamed from disk (see init_trajectory_stream), frame_buffer is used as a cache towards the file
+    // and only the frames which currently reside within the stream window have valid atom_position pointers.
     Array<TrajectoryFrame> frame_buffer{};
 
-    // This is the position data of the full trajectory
+    // This is the position data of the full trajectory, or the position data of the stream window if the trajectory is streamed
     soa_vec3 position_data{};
 
+    // Optional velocity and force data of the full trajectory, laid out like position_data
+    soa_vec3 velocity_data{};
+    soa_vec3 force_data{};
+
+    struct {
+        FILE* file = nullptr;
+        ExtractFrameFunc extract_frame = nullptr;
+        FrameBytes* frame_bytes = nullptr;
+        i32 num_slots = 0;
+        i32* slot_frame = nullptr;  // Frame index which occupies each slot, -1 if empty
+        u64* slot_tick = nullptr;   // Last access of each slot, used for LRU eviction
+        u64 tick = 0;
+        Array<u8> read_buffer{};
+        TrajectoryPrefetcher* prefetcher = nullptr;  // Optional read-ahead, see trajectory_prefetch.h
+
+        // Every part of the stream is read from its own file (see TrajectoryStreamPart), file is the file of the first part.
+        // Frames beyond the last part (appended by grow_trajectory) belong to the last part.
+        i32 num_parts = 0;
+        FILE** part_file = nullptr;
+        i32* part_frame_beg = nullptr;  // Global index of the first frame of each part
+    } stream;
+
+    // Opt-in quantized storage (see init_trajectory_quantized), each coordinate is stored as 16-bit fixed point relative to the extent of its frame.
+    // Frames are dequantized on demand into the resident window, the same way as for a streamed trajectory.
+    struct {
+        u16* data = nullptr;    // [frame][x, y, z][atom]
+        vec3* scale = nullptr;  // Per frame, position = offset + scale * q
+        vec3* offset = nullptr;
+    } quantized;
+
+    // Opt-in atom subset (see set_trajectory_atom_subset), only the positions of the selected atoms are stored and num_atoms is the size of the subset.
+    struct {
+        Bitfield mask{};            // Selection within all atoms of the structure (and of the trajectory file)
+        i32* atom_index = nullptr;  // Index within the structure of each stored atom
+    } subset;
+
+    // If the position data is backed by a memory mapped binary cache (see load_trajectory_binary_cache), this holds the mapping
+    MappedFile mapped_file{};
+
     // These are the offsets for each frame inside the file on disk.
     //Array<i64> frame_offsets{};
 
@@ -42,5 +96,74 @@ struct MoleculeTrajectory {
 // Allocates memory and initializes trajectory
 bool init_trajectory(MoleculeTrajectory* traj, i32 num_atoms, i32 num_frames, f32 time_between_frames = 1.0f, const mat3& sim_box = {});
 
+// Allocates memory and initializes trajectory in streaming mode.
+// Only window_size frames have their position data resident in memory at any time, the remaining frames are read from
+// the file on demand using the supplied frame byte offsets and decoded with extract_frame.
+bool init_trajectory_stream(MoleculeTrajectory* traj, i32 num_atoms, i32 num_frames, const FrameBytes* frame_bytes, CStringView filename,
+                            ExtractFrameFunc extract_frame, i32 window_size, f32 time_between_frames = 1.0f, const mat3& sim_box = {});
+
+// One file of a trajectory which is split over several files, e.g. traj.part0002.xtc of a Gromacs run which has been continued
+struct TrajectoryStreamPart {
+    CStringView filename;
+    const FrameBytes* frame_bytes = nullptr;  // Byte ranges of the frames within the file
+    Range<i32> frame_range = {};              // Frames of the file which belong to the trajectory, e.g. excluding leading frames which duplicate the previous part
+};
+
+// Initializes a trajectory streamed from several files, which appear as one trajectory with the frames of each part in order.
+// Only the byte ranges of the frames are combined into one index, every frame is read from the file of the part which owns it.
+bool init_trajectory_stream(MoleculeTrajectory* traj, i32 num_atoms, Array<const TrajectoryStreamPart> parts, ExtractFrameFunc extract_frame,
+                            i32 window_size, f32 time_between_frames = 1.0f, const mat3& sim_box = {});
+
+// File which holds the frame of a trajectory streamed from file
+FILE* get_trajectory_frame_file(const MoleculeTrajectory& traj, i32 frame_index);
+
+// Makes sure that the position data of the frame is resident in memory and returns the frame, nullptr if it could not be read.
+// @NOTE: For streamed trajectories the position data is only valid until window_size other frames have been fetched.
+TrajectoryFrame* fetch_trajectory_frame(MoleculeTrajectory* traj, i32 frame_index);
+
+// Allocates memory and initializes trajectory with quantized storage, roughly halving the memory footprint of the position data.
+// Frames are written with store_trajectory_frame_quantized and only window_size frames are dequantized (resident) at any time.
+bool init_trajectory_quantized(MoleculeTrajectory* traj, i32 num_atoms, i32 num_frames, i32 window_size, f32 time_between_frames = 1.0f, const mat3& sim_box = {});
+
+// Quantizes and stores the positions of a frame, the quantization range is fit to the extent of the positions.
+// Thread safe as long as each thread writes distinct frames.
+void store_trajectory_frame_quantized(MoleculeTrajectory* traj, i32 frame_index, const soa_vec3 positions);
+
+// Extends the trajectory with frames appended to its end, e.g. when following a simulation which is still writing its trajectory.
+// Existing frames are left untouched, the new frames are initialized with the box of the last frame and have to be filled by the caller
+// (or are fetched on demand for trajectories streamed from file). For streamed trajectories frame_bytes must hold the byte ranges of all frames.
+// Trajectories backed by a binary cache cannot grow.
+bool grow_trajectory(MoleculeTrajectory* traj, i32 new_num_frames, const FrameBytes* frame_bytes = nullptr);
+
+enum TrajectoryChannel : u32 {
+    TrajectoryChannel_Velocity = 1,
+    TrajectoryChannel_Force = 2,
+};
+
+// Allocates the optional per frame channels (mask of TrajectoryChannel) of a resident trajectory, zero initialized and 64-byte aligned like the positions.
+// Channels which are already allocated are kept. Not supported for streamed trajectories.
+bool init_trajectory_channels(MoleculeTrajectory* traj, u32 channels);
+
+inline bool has_trajectory_velocities(const MoleculeTrajectory& traj) { return traj.velocity_data.x != nullptr; }
+inline bool has_trajectory_forces(const MoleculeTrajectory& traj) { return traj.force_data.x != nullptr; }
+
+// Restricts the trajectory to the atoms selected by mask, traj->num_atoms must equal the number of selected atoms (the trajectory is initialized for the subset).
+// Frames are decoded for all atoms and compacted with gather_trajectory_atom_subset, subset.atom_index maps the stored atoms back to the structure.
+bool set_trajectory_atom_subset(MoleculeTrajectory* traj, const Bitfield mask);
+
+// Compacts the positions of all atoms (src) into the positions of the stored subset (dst)
+void gather_trajectory_atom_subset(const MoleculeTrajectory& traj, soa_vec3 dst, const soa_vec3 src);
+
+// @NOTE: Streamed means that only a window of frames is resident and frames have to be fetched (fetch_trajectory_frame) before accessed.
+// This is the case both for trajectories streamed from file and quantized trajectories.
+inline bool is_trajectory_streamed(const MoleculeTrajectory& traj) { return traj.stream.num_slots > 0; }
+inline bool is_trajectory_quantized(const MoleculeTrajectory& traj) { return traj.quantized.data != nullptr; }
+inline bool is_trajectory_subset(const MoleculeTrajectory& traj) { return traj.subset.atom_index != nullptr; }
+
+// Number of atoms in each frame of the source (file), which is larger than num_atoms if the trajectory only stores a subset
+inline i32 get_trajectory_source_atom_count(const MoleculeTrajectory& traj) {
+    return is_trajectory_subset(traj) ? (i32)traj.subset.mask.size() : traj.num_atoms;
+}
+
 // Frees memory allocated by trajectory
 void free_trajectory(MoleculeTrajectory* traj);
\ No newline at end of file
@@ -108,6 +108,77 @@ void translate(soa_vec3 out, const soa_vec3 in, i64 count, const vec3& translati
     }
 }
 
+void deinterleave(soa_vec3 out, const float* in_xyz, i64 count, float scale) {
+    i64 i = 0;
+
+    // @NOTE: Always 128-bit wide, three loads produce exactly four triplets
+    const i64 simd_count = (count / 4) * 4;
+    if (simd_count > 0) {
+        const simd::float128 s = simd::set_f128(scale);
+        for (; i < simd_count; i += 4) {
+            simd::float128 x, y, z;
+            simd::deinterleave_xyz(x, y, z, in_xyz + i * 3);
+            simd::store(out.x + i, simd::mul(x, s));
+            simd::store(out.y + i, simd::mul(y, s));
+            simd::store(out.z + i, simd::mul(z, s));
+        }
+    }
+
+    for (; i < count; i++) {
+        out.x[i] = in_xyz[i * 3 + 0] * scale;
+        out.y[i] = in_xyz[i * 3 + 1] * scale;
+        out.z[i] = in_xyz[i * 3 + 2] * scale;
+    }
+}
+
+void interleave(float* out_xyz, const soa_vec3 in, i64 count, float scale) {
+    for (i64 i = 0; i < count; i++) {
+        out_xyz[i * 3 + 0] = in.x[i] * scale;
+        out_xyz[i * 3 + 1] = in.y[i] * scale;
+        out_xyz[i * 3 + 2] = in.z[i] * scale;
+    }
+}
+
+void dequantize(soa_vec3 out, const u16* in_x, const u16* in_y, const u16* in_z, i64 count, const vec3& scale, const vec3& offset) {
+    i64 i = 0;
+
+    const i64 simd_count = (count / SIMD_WIDTH) * SIMD_WIDTH;
+    if (simd_count > 0) {
+        const SIMD_TYPE_F s_x = SIMD_SET_F(scale.x);
+        const SIMD_TYPE_F s_y = SIMD_SET_F(scale.y);
+        const SIMD_TYPE_F s_z = SIMD_SET_F(scale.z);
+
+        const SIMD_TYPE_F o_x = SIMD_SET_F(offset.x);
+        const SIMD_TYPE_F o_y = SIMD_SET_F(offset.y);
+        const SIMD_TYPE_F o_z = SIMD_SET_F(offset.z);
+
+        for (; i < simd_count; i += SIMD_WIDTH) {
+            const SIMD_TYPE_F x = simd::add(simd::mul(SIMD_LOAD_U16_F(in_x + i), s_x), o_x);
+            const SIMD_TYPE_F y = simd::add(simd::mul(SIMD_LOAD_U16_F(in_y + i), s_y), o_y);
+            const SIMD_TYPE_F z = simd::add(simd::mul(SIMD_LOAD_U16_F(in_z + i), s_z), o_z);
+
+            SIMD_STORE(out.x + i, x);
+            SIMD_STORE(out.y + i, y);
+            SIMD_STORE(out.z + i, z);
+        }
+    }
+
+    for (; i < count; i++) {
+        out.x[i] = in_x[i] * scale.x + offset.x;
+        out.y[i] = in_y[i] * scale.y + offset.y;
+        out.z[i] = in_z[i] * scale.z + offset.z;
+    }
+}
+
+void quantize(u16* out_x, u16* out_y, u16* out_z, const soa_vec3 in, i64 count, const vec3& scale, const vec3& offset) {
+    const vec3 inv_scale = {scale.x != 0.0f ? 1.0f / scale.x : 0.0f, scale.y != 0.0f ? 1.0f / scale.y : 0.0f, scale.z != 0.0f ? 1.0f / scale.z : 0.0f};
+    for (i64 i = 0; i < count; i++) {
+        out_x[i] = (u16)math::clamp((in.x[i] - offset.x) * inv_scale.x + 0.5f, 0.0f, 65535.0f);
+        out_y[i] = (u16)math::clamp((in.y[i] - offset.y) * inv_scale.y + 0.5f, 0.0f, 65535.0f);
+        out_z[i] = (u16)math::clamp((in.z[i] - offset.z) * inv_scale.z + 0.5f, 0.0f, 65535.0f);
+    }
+}
+
 void transform_ref(soa_vec3 in_out, i64 count, const mat4& transformation, float w_comp) {
     for (i64 i = 0; i < count; i++) {
         vec4 v = {in_out.x[i], in_out.y[i], in_out.z[i], w_comp};
@@ -692,13 +763,25 @@ void recenter_trajectory(MoleculeDynamic* dynamic, AtomRange range) {
     auto& traj = dynamic->trajectory;
     const i64 count = range.ext();
 
-    for (i64 i = 0; i < traj.num_frames; i++) {
-        auto& frame = traj.frame_buffer[i];
-        const soa_vec3 range_pos = frame.atom_position + range.beg;
-        const vec3 com = compute_com_periodic(range_pos, count, frame.box);
-        const vec3 translation = frame.box * vec3(0.5f) - com;
-        translate(frame.atom_position, traj.num_atoms, translation);
-        apply_pbc(frame.atom_position, mol.residue.atom_range, mol.residue.count, frame.box);
+    // @NOTE: Frames streamed from file are read from disk again once evicted, so the recentered positions would be lost
+    if (is_trajectory_streamed(traj) && !is_trajectory_quantized(traj)) {
+        LOG_ERROR("Cannot recenter a trajectory which is streamed from file");
+        return;
+    }
+
+    for (i32 i = 0; i < traj.num_frames; i++) {
+        TrajectoryFrame* frame = fetch_trajectory_frame(&traj, i);
+        if (!frame) {
+            LOG_ERROR("Could not fetch frame %i of trajectory", i);
+            return;
+        }
+        const soa_vec3 range_pos = frame->atom_position + range.beg;
+        const vec3 com = compute_com_periodic(range_pos, count, frame->box);
+        const vec3 translation = frame->box * vec3(0.5f) - com;
+        translate(frame->atom_position, traj.num_atoms, translation);
+        apply_pbc(frame->atom_position, mol.residue.atom_range, mol.residue.count, frame->box);
+        // Quantized frames are only resident within the window, so the result has to be written back to the quantized storage
+        if (is_trajectory_quantized(traj)) store_trajectory_frame_quantized(&traj, i, frame->atom_position);
     }
 }
 
@@ -23,6 +23,17 @@ struct EigenFrame {
 void translate(soa_vec3 in_out, i64 count, const vec3& translation);
 void translate(soa_vec3 out, const soa_vec3 in, i64 count, const vec3& translation);
 
+// Deinterleaves packed xyz triplets into separate x, y and z arrays and scales them uniformly
+void deinterleave(soa_vec3 out, const float* in_xyz, i64 count, float scale = 1.0f);
+// Interleaves separate x, y and z arrays into packed xyz triplets and scales them uniformly
+void interleave(float* out_xyz, const soa_vec3 in, i64 count, float scale = 1.0f);
+
+// Converts 16-bit fixed point coordinates to floating point: out = offset + scale * in
+void dequantize(soa_vec3 out, const u16* in_x, const u16* in_y, const u16* in_z, i64 count, const vec3& scale, const vec3& offset);
+
+// Converts coordinates to 16-bit fixed point (rounded to nearest), inverse of dequantize. Coordinates outside the representable range are clamped
+void quantize(u16* out_x, u16* out_y, u16* out_z, const soa_vec3 in, i64 count, const vec3& scale, const vec3& offset);
+
 // Transforms points as homogeneous vectors[x,y,z,w*] with supplied transformation matrix (NO 'perspective' division is done)
 // W-component is supplied by user
 void transform(soa_vec3 in_out, i64 count, const mat4& transformation, float w_comp = 1.0f);
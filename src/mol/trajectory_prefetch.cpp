@@ -0,0 +1,275 @@
+#include "trajectory_prefetch.h"
+#include <core/common.h>
+#include <core/log.h>
+#include <core/file.h>
+#include <core/sync.h>
+#include <mol/trajectory_utils.h>
+
+#define ALIGNMENT 64
+
+struct PrefetchEntry {
+    i32 frame_index = -1;  // -1 if empty
+    bool ready = false;    // false while the worker is decoding into it
+    TrajectoryFrame frame{};
+};
+
+struct TrajectoryPrefetcher {
+    MoleculeTrajectory* traj = nullptr;
+
+    i32 ring_size = 0;
+    PrefetchEntry* ring = nullptr;
+    float* position_mem = nullptr;
+    Array<u8> read_buffer{};
+
+    mutex mtx;
+    condition_variable cv;
+    thread worker;
+    bool exit = false;
+
+    // Playback state, guarded by mtx
+    i32 cursor = 0;
+    i32 stride = 1;        // Signed distance between consecutive requests, i.e. direction and speed of playback
+    u64 generation = 0;    // Incremented on seek, decoded frames of an older generation are discarded
+
+    TrajectoryPrefetchStats stats{};
+};
+
+// Returns the frame which should be decoded next, -1 if everything within the window ahead of the cursor is already in the ring
+static i32 next_frame_to_prefetch(const TrajectoryPrefetcher& pf) {
+    const i32 num_frames = pf.traj->num_frames;
+    for (i32 k = 1; k <= pf.ring_size; k++) {
+        const i32 f = pf.cursor + k * pf.stride;
+        if (f < 0 || num_frames <= f) break;
+        bool found = false;
+        for (i32 i = 0; i < pf.ring_size; i++) {
+            if (pf.ring[i].frame_index == f) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) return f;
+    }
+    return -1;
+}
+
+static bool within_window(const TrajectoryPrefetcher& pf, i32 frame_index) {
+    const i32 delta = frame_index - pf.cursor;
+    if (pf.stride > 0) return 0 <= delta && delta <= pf.ring_size * pf.stride;
+    return pf.ring_size * pf.stride <= delta && delta <= 0;
+}
+
+// Picks an entry which is empty or holds a frame outside of the window, -1 if there is none
+static i32 find_free_entry(const TrajectoryPrefetcher& pf) {
+    for (i32 i = 0; i < pf.ring_size; i++) {
+        const PrefetchEntry& e = pf.ring[i];
+        if (e.frame_index == -1) return i;
+    }
+    for (i32 i = 0; i < pf.ring_size; i++) {
+        const PrefetchEntry& e = pf.ring[i];
+        if (e.ready && !within_window(pf, e.frame_index)) return i;
+    }
+    return -1;
+}
+
+static void worker_func(TrajectoryPrefetcher* pf) {
+    MoleculeTrajectory* traj = pf->traj;
+    std::unique_lock<mutex> lock(pf->mtx);
+
+    while (!pf->exit) {
+        i32 frame_index = -1;
+        i32 entry_idx = -1;
+        pf->cv.wait(lock, [pf, &frame_index, &entry_idx] {
+            if (pf->exit) return true;
+            frame_index = next_frame_to_prefetch(*pf);
+            entry_idx = frame_index != -1 ? find_free_entry(*pf) : -1;
+            return entry_idx != -1;
+        });
+        if (pf->exit) break;
+
+        PrefetchEntry& entry = pf->ring[entry_idx];
+        entry.frame_index = frame_index;
+        entry.ready = false;
+        const u64 generation = pf->generation;
+        const i32 cursor = pf->cursor;
+        const FrameBytes bytes = traj->stream.frame_bytes[frame_index];
+        TrajectoryFrame frame{};
+        frame.atom_position = entry.frame.atom_position;
+
+        // Read and decode without holding the lock, the entry is not visible to the consumer until it is ready
+        lock.unlock();
+        FILE* file = get_trajectory_frame_file(*traj, frame_index);
+        const i64 bytes_read = read_file_at(file, pf->read_buffer.ptr, (i64)bytes.extent, (i64)bytes.offset);
+        const bool ok = bytes_read == (i64)bytes.extent && traj->stream.extract_frame(&frame, traj->num_atoms, {pf->read_buffer.ptr, bytes_read});
+        frame.index = frame_index;
+        lock.lock();
+
+        if (ok && generation == pf->generation) {
+            entry.frame = frame;
+            entry.ready = true;
+            pf->stats.frames_decoded++;
+        } else {
+            if (!ok) LOG_ERROR("Could not prefetch frame %i", frame_index);
+            if (generation != pf->generation) pf->stats.frames_discarded++;
+            entry.frame_index = -1;
+            entry.ready = false;
+            // @NOTE: Do not retry a failing frame over and over, wait until the cursor moves (by a seek or by playback within the ring)
+            if (!ok) pf->cv.wait(lock, [pf, generation, cursor] { return pf->exit || generation != pf->generation || cursor != pf->cursor; });
+        }
+    }
+}
+
+// Expects the lock to be held
+static void cancel_prefetch(TrajectoryPrefetcher* pf) {
+    pf->generation++;
+    for (i32 i = 0; i < pf->ring_size; i++) {
+        PrefetchEntry& e = pf->ring[i];
+        // @NOTE: Entries which are currently being decoded are discarded by the worker once it notices the new generation
+        if (e.ready && !within_window(*pf, e.frame_index)) {
+            pf->stats.frames_discarded++;
+            e.frame_index = -1;
+            e.ready = false;
+        }
+    }
+}
+
+bool start_trajectory_prefetch(MoleculeTrajectory* traj, i32 ring_size) {
+    ASSERT(traj);
+    if (!is_trajectory_streamed(*traj) || is_trajectory_quantized(*traj) || !traj->stream.file) {
+        LOG_ERROR("Prefetching requires a trajectory streamed from file");
+        return false;
+    }
+    if (ring_size <= 0) {
+        LOG_ERROR("Invalid prefetch ring size");
+        return false;
+    }
+    if (traj->stream.prefetcher) stop_trajectory_prefetch(traj);
+
+    const i32 num_atoms = traj->num_atoms;
+    const i64 position_plane_size = ((i64)num_atoms * sizeof(float) + ALIGNMENT - 1) & ~(i64)(ALIGNMENT - 1);
+    float* position_mem = (float*)ALIGNED_MALLOC(position_plane_size * 3 * ring_size, ALIGNMENT);
+    PrefetchEntry* ring = (PrefetchEntry*)MALLOC(ring_size * sizeof(PrefetchEntry) + traj->stream.read_buffer.size());
+    if (!position_mem || !ring) {
+        LOG_ERROR("Could not allocate memory for trajectory prefetch");
+        if (position_mem) ALIGNED_FREE(position_mem);
+        if (ring) FREE(ring);
+        return false;
+    }
+
+    TrajectoryPrefetcher* pf = (TrajectoryPrefetcher*)MALLOC(sizeof(TrajectoryPrefetcher));
+    PLACEMENT_NEW(pf) TrajectoryPrefetcher();
+    pf->traj = traj;
+    pf->ring_size = ring_size;
+    pf->ring = ring;
+    pf->position_mem = position_mem;
+    pf->read_buffer = {(u8*)(ring + ring_size), traj->stream.read_buffer.size()};
+
+    for (i32 i = 0; i < ring_size; i++) {
+        PLACEMENT_NEW(ring + i) PrefetchEntry();
+        float* base = (float*)((u8*)position_mem + position_plane_size * 3 * i);
+        ring[i].frame.atom_position.x = base;
+        ring[i].frame.atom_position.y = (float*)((u8*)base + position_plane_size);
+        ring[i].frame.atom_position.z = (float*)((u8*)base + position_plane_size * 2);
+    }
+
+    pf->worker = thread(worker_func, pf);
+    traj->stream.prefetcher = pf;
+    return true;
+}
+
+void stop_trajectory_prefetch(MoleculeTrajectory* traj) {
+    ASSERT(traj);
+    TrajectoryPrefetcher* pf = traj->stream.prefetcher;
+    if (!pf) return;
+
+    {
+        std::lock_guard<mutex> lock(pf->mtx);
+        pf->exit = true;
+    }
+    pf->cv.notify_all();
+    pf->worker.join();
+
+    ALIGNED_FREE(pf->position_mem);
+    FREE(pf->ring);
+    pf->~TrajectoryPrefetcher();
+    FREE(pf);
+    traj->stream.prefetcher = nullptr;
+}
+
+void seek_trajectory_prefetch(MoleculeTrajectory* traj, i32 frame_index) {
+    ASSERT(traj);
+    TrajectoryPrefetcher* pf = traj->stream.prefetcher;
+    if (!pf) return;
+
+    {
+        std::lock_guard<mutex> lock(pf->mtx);
+        pf->cursor = frame_index;
+        cancel_prefetch(pf);
+    }
+    pf->cv.notify_all();
+}
+
+bool take_prefetched_frame(TrajectoryPrefetcher* pf, i32 frame_index, TrajectoryFrame* dst) {
+    ASSERT(pf);
+    ASSERT(dst);
+
+    bool hit = false;
+    {
+        std::lock_guard<mutex> lock(pf->mtx);
+
+        const i32 delta = frame_index - pf->cursor;
+        if (delta != 0) {
+            const i32 max_stride = pf->ring_size;
+            if (-max_stride <= delta && delta <= max_stride) {
+                pf->stride = delta;
+                pf->cursor = frame_index;
+            } else {
+                // Jumped outside of what could have been prefetched, treat it as a seek
+                pf->cursor = frame_index;
+                cancel_prefetch(pf);
+            }
+        }
+
+        for (i32 i = 0; i < pf->ring_size; i++) {
+            PrefetchEntry& e = pf->ring[i];
+            if (e.ready && e.frame_index == frame_index) {
+                const i64 size = pf->traj->num_atoms * sizeof(float);
+                memcpy(dst->atom_position.x, e.frame.atom_position.x, size);
+                memcpy(dst->atom_position.y, e.frame.atom_position.y, size);
+                memcpy(dst->atom_position.z, e.frame.atom_position.z, size);
+                dst->time = e.frame.time;
+                dst->box = e.frame.box;
+                dst->index = frame_index;
+                // The frame now resides in the trajectory window, so the entry can be reused
+                e.frame_index = -1;
+                e.ready = false;
+                hit = true;
+                break;
+            }
+        }
+
+        if (hit) pf->stats.hits++;
+        else pf->stats.misses++;
+    }
+    pf->cv.notify_all();
+
+    return hit;
+}
+
+TrajectoryPrefetchStats get_trajectory_prefetch_stats(const MoleculeTrajectory& traj) {
+    TrajectoryPrefetcher* pf = traj.stream.prefetcher;
+    if (!pf) return {};
+    std::lock_guard<mutex> lock(pf->mtx);
+    return pf->stats;
+}
+
+void reset_trajectory_prefetch_stats(MoleculeTrajectory* traj) {
+    ASSERT(traj);
+    TrajectoryPrefetcher* pf = traj->stream.prefetcher;
+    if (!pf) return;
+    std::lock_guard<mutex> lock(pf->mtx);
+    pf->stats = {};
+}
+
+i32 get_trajectory_prefetch_ring_size(const MoleculeTrajectory& traj) {
+    return traj.stream.prefetcher ? traj.stream.prefetcher->ring_size : 0;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <core/types.h>
+#include <mol/molecule_trajectory.h>
+
+// Background read-ahead for trajectories streamed from file (see init_trajectory_stream).
+// A worker thread reads and decodes the frames which lie ahead of the playback cursor into a ring of decoded frames.
+// The direction and speed of playback is derived from consecutive frame requests, a jump larger than the ring is treated as a seek.
+
+struct TrajectoryPrefetcher;
+
+struct TrajectoryPrefetchStats {
+    i64 hits = 0;              // Requested frames which were already decoded
+    i64 misses = 0;            // Requested frames which had to be decoded on demand
+    i64 frames_decoded = 0;    // Frames decoded by the worker
+    i64 frames_discarded = 0;  // Frames decoded by the worker which were thrown away because of a seek
+};
+
+// Starts prefetching for the streamed trajectory, ring_size is the number of decoded frames kept ahead of the cursor
+bool start_trajectory_prefetch(MoleculeTrajectory* traj, i32 ring_size);
+
+// Stops the worker thread and frees the ring
+void stop_trajectory_prefetch(MoleculeTrajectory* traj);
+
+// Cancels all pending and decoded frames and restarts the read-ahead from frame_index, call this when the user seeks
+void seek_trajectory_prefetch(MoleculeTrajectory* traj, i32 frame_index);
+
+// Copies the frame into dst if it has been prefetched, returns false on a miss.
+// Also advances the playback cursor, which steers the read-ahead. Used internally by fetch_trajectory_frame.
+bool take_prefetched_frame(TrajectoryPrefetcher* prefetcher, i32 frame_index, TrajectoryFrame* dst);
+
+TrajectoryPrefetchStats get_trajectory_prefetch_stats(const MoleculeTrajectory& traj);
+void reset_trajectory_prefetch_stats(MoleculeTrajectory* traj);
+
+// Returns 0 if the trajectory is not prefetched
+i32 get_trajectory_prefetch_ring_size(const MoleculeTrajectory& traj);